@@ -16,6 +16,9 @@ public:
     // Merge two bounding boxes
     bbox(const bbox &a, const bbox &b) : x(a.x, b.x), y(a.y, b.y), z(a.z, b.z) {}
 
+    // Grow a bounding box to contain a point
+    bbox(const bbox &a, const vec3 &p) : x(a.x, interval(p.x(), p.x())), y(a.y, interval(p.y(), p.y())), z(a.z, interval(p.z(), p.z())) {}
+
     int longest_axis() const
     {
         if (x.size() > y.size() && x.size() > z.size())
@@ -25,40 +28,73 @@ public:
         return 2;
     }
 
-    interval get(int axis) const
+    const interval &get(int axis) const
     {
         return axis == 0   ? x
                : axis == 1 ? y
                            : z;
     }
 
+    vec3 centroid() const
+    {
+        return vec3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+    }
+
     // Calculate surface area of the bounding box
-    double surface_area() const
+    real surface_area() const
     {
-        double dx = x.size();
-        double dy = y.size();
-        double dz = z.size();
+        real dx = x.size();
+        real dy = y.size();
+        real dz = z.size();
 
         // Surface area = 2*(dx*dy + dx*dz + dy*dz)
         return 2.0 * (dx * dy + dx * dz + dy * dz);
     }
 
-    // Ray intersection test
+    // Ray intersection test (branchless slab test)
     bool hit(const ray &r, interval ray_t) const
     {
-        for (int i = 0; i < 3; i++)
-        {
-            double invD = 1.0 / r.direction()[i];
-            double t0 = (get(i).min - r.origin()[i]) * invD;
-            double t1 = (get(i).max - r.origin()[i]) * invD;
-            if (invD < 0.0)
-                std::swap(t0, t1);
-            ray_t.min = t0 > ray_t.min ? t0 : ray_t.min;
-            ray_t.max = t1 < ray_t.max ? t1 : ray_t.max;
-            if (ray_t.max <= ray_t.min)
-                return false;
-        }
-        return true;
+        const vec3 &o = r.origin();
+        const vec3 &inv = r.inv_direction();
+
+        real tx0 = (x.min - o[0]) * inv[0];
+        real tx1 = (x.max - o[0]) * inv[0];
+        ray_t.min = std::max(ray_t.min, std::min(tx0, tx1));
+        ray_t.max = std::min(ray_t.max, std::max(tx0, tx1));
+
+        real ty0 = (y.min - o[1]) * inv[1];
+        real ty1 = (y.max - o[1]) * inv[1];
+        ray_t.min = std::max(ray_t.min, std::min(ty0, ty1));
+        ray_t.max = std::min(ray_t.max, std::max(ty0, ty1));
+
+        real tz0 = (z.min - o[2]) * inv[2];
+        real tz1 = (z.max - o[2]) * inv[2];
+        ray_t.min = std::max(ray_t.min, std::min(tz0, tz1));
+        ray_t.max = std::min(ray_t.max, std::max(tz0, tz1));
+
+        return ray_t.min < ray_t.max;
+    }
+
+    // Packet intersection test against [p.t_min, p.t_max] of every lane
+    // Returns one bit per lane that hits the box
+    int hit(const ray_packet &p) const
+    {
+        double4 tx0 = (splat4(x.min) - p.ox) * p.ix;
+        double4 tx1 = (splat4(x.max) - p.ox) * p.ix;
+        double4 t_min = max4(p.t_min, min4(tx0, tx1));
+        double4 t_max = min4(p.t_max, max4(tx0, tx1));
+
+        double4 ty0 = (splat4(y.min) - p.oy) * p.iy;
+        double4 ty1 = (splat4(y.max) - p.oy) * p.iy;
+        t_min = max4(t_min, min4(ty0, ty1));
+        t_max = min4(t_max, max4(ty0, ty1));
+
+        double4 tz0 = (splat4(z.min) - p.oz) * p.iz;
+        double4 tz1 = (splat4(z.max) - p.oz) * p.iz;
+        t_min = max4(t_min, min4(tz0, tz1));
+        t_max = min4(t_max, max4(tz0, tz1));
+
+        return movemask4(t_min < t_max);
     }
 
     static const bbox empty, universe;
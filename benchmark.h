@@ -0,0 +1,80 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <iomanip>
+
+// Slab test as it was before rays cached their inverse direction:
+// three divisions per test, a copied interval per axis and a branch per axis.
+// Kept only as the baseline for the node-test benchmark.
+inline bool legacy_bbox_hit(const bbox &b, const ray &r, interval ray_t)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        interval axis = b.get(i);
+        double invD = 1.0 / r.direction()[i];
+        double t0 = (axis.min - r.origin()[i]) * invD;
+        double t1 = (axis.max - r.origin()[i]) * invD;
+        if (invD < 0.0)
+            std::swap(t0, t1);
+        ray_t.min = t0 > ray_t.min ? t0 : ray_t.min;
+        ray_t.max = t1 < ray_t.max ? t1 : ray_t.max;
+        if (ray_t.max <= ray_t.min)
+            return false;
+    }
+    return true;
+}
+
+// Test every ray against every node box of the BVH and report node-tests per second
+// Rays start at `origin` and point at random spots inside the scene bounds,
+// the same box mix a camera at `origin` sees during traversal.
+void benchmark_node_tests(const BVH &bvh, const vec3 &origin, int n_rays, uint64_t seed)
+{
+    if (bvh.nodes.empty() || n_rays <= 0)
+        return;
+
+    sampler rng(seed);
+    bbox scene = bvh.get_bbox();
+    std::vector<ray> rays;
+    rays.reserve(n_rays);
+    for (int i = 0; i < n_rays; i++)
+    {
+        vec3 target(random_double(rng, scene.x.min, scene.x.max),
+                     random_double(rng, scene.y.min, scene.y.max),
+                     random_double(rng, scene.z.min, scene.z.max));
+        rays.push_back(ray(origin, (target - origin).normalized()));
+    }
+
+    std::vector<bbox> boxes;
+    boxes.reserve(bvh.nodes.size());
+    for (const auto &node : bvh.nodes)
+        boxes.push_back(node.box());
+
+    double n_tests = double(rays.size()) * boxes.size();
+    const interval ray_t(0, infinity);
+
+    auto run = [&](const char *name, auto test)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t hits = 0;
+        for (const auto &r : rays)
+            for (size_t k = 0; k < boxes.size(); k++)
+                hits += test(r, k);
+        auto end = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        std::cout << "[Bench] " << std::left << std::setw(22) << name
+                  << std::fixed << std::setprecision(1) << n_tests / seconds / 1e6 << " M node-tests/s"
+                  << " (" << hits << " hits)\n"
+                  << std::defaultfloat;
+    };
+
+    std::cout << "[Bench] " << rays.size() << " rays x " << boxes.size() << " nodes\n";
+    run("legacy slab", [&](const ray &r, size_t k)
+        { return legacy_bbox_hit(boxes[k], r, ray_t); });
+    run("branchless bbox", [&](const ray &r, size_t k)
+        { return boxes[k].hit(r, ray_t); });
+    run("branchless node", [&](const ray &r, size_t k)
+        { return bvh.nodes[k].hit(r, ray_t); });
+}
+
+#endif
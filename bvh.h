@@ -1,229 +1,1323 @@
 #ifndef BVH_H
 #define BVH_H
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <typeinfo>
+#include "sphere.h"
+#include "triangle.h"
+
 // BVH splitting strategies
 enum class BVHSplitMethod
 {
     MIDDLE, // Median split
-    SAH     // Surface Area Heuristic optimized split
+    SAH,    // Surface Area Heuristic optimized split
+    LBVH,   // Morton order linear BVH, fastest build
+    HLBVH   // LBVH treelets joined by an SAH upper tree
 };
 
-// BVH node types
-enum class BVHNodeType
+// Primitive types intersected inline in BVH leaves
+// Anything else is a HITTABLE and goes through the virtual hittable::hit.
+enum class BVHPrimType : uint8_t
 {
-    LEAF,
-    INTERNAL
+    HITTABLE,
+    SPHERE,
+    TRIANGLE,
+    MIXED // Leaf tag only: the leaf holds one run of each of several types
 };
 
-class BVHNode : public hittable
+// Packed geometry of the inline primitive types, stored in leaf order
+struct SpherePrim
 {
-public:
-    BVHNodeType type;
-    bbox b;
-    shared_ptr<BVHNode> left;
-    shared_ptr<BVHNode> right;
-    std::vector<shared_ptr<hittable>> objects; // Only leaf nodes store objects
-    int depth;
-    std::string path;
+    vec3 center;
+    real radius;
+};
+
+struct TrianglePrim
+{
+    vec3 p0, e1, e2; // First vertex and the two edges leaving it
+};
 
-    // Recursive construction function
-    BVHNode(std::vector<shared_ptr<hittable>> &src_objects,
-            size_t start, size_t end,
-            int max_leaf_size,
-            BVHSplitMethod split_method = BVHSplitMethod::SAH, // Default to SAH
-            int depth = 0, std::string path = "") : depth(depth), path(path)
+// Flattened BVH node (32 bytes, two nodes per cache line)
+// Nodes are stored in depth-first order, so the first child of an interior
+// node is always the next node in the array and only the second child needs
+// an offset.
+struct alignas(32) LinearBVHNode
+{
+    float bounds[2][3]; // [0] = min corner, [1] = max corner
+    union
     {
-        // 1. Compute current node's bounding box
-        b = bbox::empty;
-        for (size_t i = start; i < end; i++)
-            b = bbox(b, src_objects[i]->get_bbox());
+        int primitives_offset;   // Leaf: first primitive in BVH::primitives
+        int second_child_offset; // Interior: index of the second child
+    };
+    uint16_t n_primitives; // 0 for interior nodes
+    uint8_t axis;          // Split axis of interior nodes
+    uint8_t prim_type;     // Leaf: BVHPrimType of its primitives
 
-        // 2. Check recursion termination condition
-        size_t object_count = end - start;
-        if (object_count <= max_leaf_size)
+    bool is_leaf() const { return n_primitives > 0; }
+
+    bbox box() const
+    {
+        return bbox(interval(bounds[0][0], bounds[1][0]),
+                    interval(bounds[0][1], bounds[1][1]),
+                    interval(bounds[0][2], bounds[1][2]));
+    }
+
+    // Ray intersection test
+    // The ray's direction signs pick the near/far planes, so no swap or
+    // per-axis early exit is needed and the test compiles to min/max only
+    bool hit(const ray &r, interval ray_t) const
+    {
+        const vec3 &o = r.origin();
+        const vec3 &inv = r.inv_direction();
+        for (int i = 0; i < 3; i++)
         {
-            type = BVHNodeType::LEAF;
-            objects.assign(src_objects.begin() + start,
-                           src_objects.begin() + end);
+            real t0 = (bounds[r.sign(i)][i] - o[i]) * inv[i];
+            real t1 = (bounds[1 - r.sign(i)][i] - o[i]) * inv[i];
+            ray_t.min = std::max(ray_t.min, t0);
+            ray_t.max = std::min(ray_t.max, t1);
+        }
+        return ray_t.min < ray_t.max;
+    }
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode must stay 32 bytes");
+
+// Per-primitive data used during construction
+struct BVHPrimitiveInfo
+{
+    size_t index; // Position in the source object list
+    bbox bounds;
+    vec3 centroid;
+};
+
+// Morton code of a primitive centroid, sorted to build the LBVH
+struct MortonPrimitive
+{
+    uint32_t code;  // 10 bits per axis, interleaved x y z
+    uint32_t index; // Position in the primitive info list
+};
+
+// Temporary tree node, flattened into LinearBVHNode once the build is done
+struct BVHBuildNode
+{
+    bbox bounds;
+    std::unique_ptr<BVHBuildNode> children[2]; // Both null for leaves
+    int split_axis = 0;
+    size_t first_prim = 0;
+    size_t n_prims = 0;
+};
+
+// Debug information, kept out of the 32-byte nodes
+struct BVHNodeInfo
+{
+    int depth;
+    std::string path; // "0" = left, "1" = right, from the root
+};
+
+// Traversal counters, only updated while `enabled` is set
+// Each query accumulates locally and adds once, so the atomics stay cold.
+struct BVHStats
+{
+    bool enabled = false;
+    mutable std::atomic<uint64_t> rays{0};
+    mutable std::atomic<uint64_t> steps{0};      // Nodes visited
+    mutable std::atomic<uint64_t> prim_tests{0}; // Primitive intersection tests
+
+    void add(uint64_t n_rays, uint64_t n_steps, uint64_t n_prim_tests) const
+    {
+        if (!enabled)
+            return;
+        rays.fetch_add(n_rays, std::memory_order_relaxed);
+        steps.fetch_add(n_steps, std::memory_order_relaxed);
+        prim_tests.fetch_add(n_prim_tests, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        rays = 0;
+        steps = 0;
+        prim_tests = 0;
+    }
+};
+
+class BVH : public hittable
+{
+public:
+    std::vector<LinearBVHNode> nodes;
+    std::vector<BVHNodeInfo> node_info;
+    std::vector<shared_ptr<hittable>> primitives; // Ordered so that each leaf is a contiguous range
+    std::vector<uint8_t> prim_types;              // BVHPrimType of each primitive
+    std::vector<uint32_t> prim_index;             // Position in spheres/triangles of each primitive
+    std::vector<SpherePrim> spheres;
+    std::vector<TrianglePrim> triangles;
+    BVHStats stats;
+    double build_cost = 0; // SAH cost right after construction
+
+    static constexpr int MAX_STACK_DEPTH = 128;
+
+    BVH(const std::vector<shared_ptr<hittable>> &src_objects,
+        int max_leaf_size,
+        BVHSplitMethod split_method = BVHSplitMethod::SAH, // Default to SAH
+        bool parallel = true)
+    {
+        if (src_objects.empty())
             return;
+
+        // Bounds and centroids are fetched once, the build never calls get_bbox() again
+        std::vector<BVHPrimitiveInfo> info(src_objects.size());
+#pragma omp parallel for if (parallel)
+        for (size_t i = 0; i < src_objects.size(); i++)
+        {
+            info[i].index = i;
+            info[i].bounds = src_objects[i]->get_bbox();
+            info[i].centroid = info[i].bounds.centroid();
         }
 
-        // 3. Choose splitting method based on strategy
-        size_t split_pos = start;
-        int split_axis = b.longest_axis(); // Default to longest axis
+        build_nodes(info, max_leaf_size, split_method, parallel);
 
-        if (split_method == BVHSplitMethod::SAH)
+        // Leaves index into the objects in their final order, grouped by type
+        // inside each leaf so that every type forms one run
+        std::vector<uint8_t> src_types(src_objects.size());
+#pragma omp parallel for if (parallel)
+        for (size_t i = 0; i < src_objects.size(); i++)
+            src_types[i] = uint8_t(prim_type_of(src_objects[i].get()));
+#pragma omp parallel for if (parallel)
+        for (size_t i = 0; i < nodes.size(); i++)
         {
-            // Try SAH split first, fall back to median if fails
-            if (!try_sah_split(src_objects, start, end, split_axis, split_pos))
+            if (!nodes[i].is_leaf())
+                continue;
+            auto first = info.begin() + nodes[i].primitives_offset;
+            std::stable_sort(first, first + nodes[i].n_primitives, [&](const auto &a, const auto &b)
+                             { return src_types[a.index] < src_types[b.index]; });
+        }
+
+        primitives.reserve(info.size());
+        prim_types.reserve(info.size());
+        for (const auto &prim : info)
+        {
+            primitives.push_back(src_objects[prim.index]);
+            prim_types.push_back(src_types[prim.index]);
+        }
+        pack_primitives(parallel);
+    }
+
+    // Build over bounds gathered by the caller, for primitives that are not
+    // hittables (e.g. triangles of an indexed mesh). `info` is reordered so
+    // leaves cover contiguous ranges of it, the caller reorders its data the same way.
+    BVH(std::vector<BVHPrimitiveInfo> &info,
+        int max_leaf_size,
+        BVHSplitMethod split_method = BVHSplitMethod::SAH,
+        bool parallel = true)
+    {
+        if (!info.empty())
+            build_nodes(info, max_leaf_size, split_method, parallel);
+    }
+
+    // Recompute node bounds after the primitives moved, keeping the topology
+    void refit()
+    {
+        pack_primitives();
+        refit([&](int i)
+              { return primitives[i]->get_bbox(); });
+    }
+
+    // Refit with the bounds of primitive i (in leaf order) given by `prim_bounds(i)`
+    // Children always come after their parent, so one reverse pass is enough.
+    template <typename PrimBounds>
+    void refit(PrimBounds &&prim_bounds)
+    {
+        for (int i = int(nodes.size()) - 1; i >= 0; i--)
+        {
+            LinearBVHNode &node = nodes[i];
+            bbox b = bbox::empty;
+            if (node.is_leaf())
             {
-                middle_split(src_objects, start, end, split_axis, split_pos);
+                for (int k = 0; k < node.n_primitives; k++)
+                    b = bbox(b, prim_bounds(node.primitives_offset + k));
             }
+            else
+                b = bbox(nodes[i + 1].box(), nodes[node.second_child_offset].box());
+            set_bounds(node, b);
         }
-        else
+    }
+
+    // Expected cost of a random ray through the tree
+    // Each node is weighted by the probability of hitting it given the root was
+    // hit: one unit per interior node visit and per primitive test in leaves.
+    double sah_cost() const
+    {
+        if (nodes.empty())
+            return 0;
+        double root_area = nodes[0].box().surface_area();
+        if (root_area <= 0)
+            return 0;
+
+        double cost = 0;
+        for (const auto &node : nodes)
+            cost += node.box().surface_area() / root_area * (node.is_leaf() ? node.n_primitives : 1);
+        return cost;
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        return traverse(r, ray_t, rec, [&](const LinearBVHNode &leaf, interval &t, hit_record &leaf_rec)
+                        { return hit_leaf(r, leaf, t, leaf_rec); });
+    }
+
+    // Any-hit query, stops at the first primitive found in ray_t
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        hit_record unused;
+        return traverse<true>(r, ray_t, unused, [&](const LinearBVHNode &leaf, interval &t, hit_record &)
+                              { return occluded_leaf(r, leaf, t); });
+    }
+
+    // Closest hit among the primitives of a leaf, shrinking t.max to each hit
+    // The leaf tag says which type its primitives are, so spheres and
+    // triangles run as tight loops over their packed arrays without a virtual
+    // call. MIXED leaves are walked run by run.
+    bool hit_leaf(const ray &r, const LinearBVHNode &leaf, interval &t, hit_record &rec) const
+    {
+        int first = leaf.primitives_offset;
+        int end = first + leaf.n_primitives;
+        if (leaf.prim_type != uint8_t(BVHPrimType::MIXED))
+            return hit_run(r, BVHPrimType(leaf.prim_type), first, end, t, rec);
+
+        bool hit_anything = false;
+        for (int run = first; run < end;)
         {
-            // Always use median split
-            middle_split(src_objects, start, end, split_axis, split_pos);
+            int run_end = run + 1;
+            while (run_end < end && prim_types[run_end] == prim_types[run])
+                run_end++;
+            hit_anything |= hit_run(r, BVHPrimType(prim_types[run]), run, run_end, t, rec);
+            run = run_end;
         }
+        return hit_anything;
+    }
 
-        // 4. Recursively build child nodes (maintain same splitting strategy)
-        type = BVHNodeType::INTERNAL;
-        left = make_shared<BVHNode>(src_objects, start, split_pos,
-                                    max_leaf_size, split_method,
-                                    depth + 1, path + "0");
-        right = make_shared<BVHNode>(src_objects, split_pos, end,
-                                     max_leaf_size, split_method,
-                                     depth + 1, path + "1");
-   }
+    // True when any primitive of a leaf intersects the ray in t
+    bool occluded_leaf(const ray &r, const LinearBVHNode &leaf, const interval &t) const
+    {
+        int first = leaf.primitives_offset;
+        int end = first + leaf.n_primitives;
+        for (int run = first; run < end;)
+        {
+            int run_end = run + 1;
+            while (run_end < end && prim_types[run_end] == prim_types[run])
+                run_end++;
+            if (occluded_run(r, BVHPrimType(prim_types[run]), run, run_end, t))
+                return true;
+            run = run_end;
+        }
+        return false;
+    }
 
-    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    // Closest-hit traversal
+    // `hit_leaf(leaf, ray_t, rec)` intersects the primitives of a leaf node,
+    // shrinks ray_t.max to each hit and returns true when anything was hit.
+    // With ANY_HIT the traversal stops at the first leaf that reports a hit.
+    template <bool ANY_HIT = false, typename LeafHit>
+    bool traverse(const ray &r, interval ray_t, hit_record &rec, LeafHit &&hit_leaf) const
     {
-        if (!b.hit(r, ray_t))
+        if (nodes.empty())
             return false;
 
-        if (type == BVHNodeType::LEAF)
+        bool hit_anything = false;
+        uint64_t steps = 0, prim_tests = 0;
+        int to_visit[MAX_STACK_DEPTH];
+        int to_visit_offset = 0;
+        int current = 0;
+
+        while (true)
         {
-            bool hit_anything = false;
-            for (const auto &object : objects)
+            const LinearBVHNode &node = nodes[current];
+            steps++;
+            if (node.hit(r, ray_t))
             {
-                if (object->hit(r, ray_t, rec))
+                if (node.is_leaf())
                 {
-                    hit_anything = true;
-                    ray_t.max = rec.t;
-                    rec.bvh_depth = depth;
-                    rec.bvh_path = path;
+                    prim_tests += node.n_primitives;
+                    if (hit_leaf(node, ray_t, rec))
+                    {
+                        hit_anything = true;
+                        if constexpr (ANY_HIT)
+                            break;
+                        // A primitive that is a BVH itself (mesh, instance) already recorded its own node
+                        if (!rec.bvh_info)
+                            rec.bvh_info = &node_info[current];
+                    }
+                    if (to_visit_offset == 0)
+                        break;
+                    current = to_visit[--to_visit_offset];
+                }
+                else
+                {
+                    // Visit the nearer child first, so ray_t.max shrinks early
+                    if (r.sign(node.axis))
+                    {
+                        to_visit[to_visit_offset++] = current + 1;
+                        current = node.second_child_offset;
+                    }
+                    else
+                    {
+                        to_visit[to_visit_offset++] = node.second_child_offset;
+                        current = current + 1;
+                    }
                 }
             }
-            return hit_anything;
+            else
+            {
+                if (to_visit_offset == 0)
+                    break;
+                current = to_visit[--to_visit_offset];
+            }
         }
 
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        stats.add(1, steps, prim_tests);
+        return hit_anything;
+    }
+
+    // Packet traversal, a node is visited while any of its lanes is still alive
+    int hit(ray_packet &p, int active, hit_record *recs) const override
+    {
+        if (nodes.empty())
+            return 0;
+
+        struct StackEntry
+        {
+            int node;
+            int lanes;
+        };
+
+        // Coherent packets share direction signs, take the near-child order of one lane
+        int lead = 0;
+        while (!(active >> lead & 1))
+            lead++;
+        const ray &lead_ray = p.rays[lead];
+
+        int hits = 0;
+        uint64_t steps = 0, prim_tests = 0;
+        StackEntry to_visit[MAX_STACK_DEPTH];
+        int to_visit_offset = 0;
+        int current = 0;
+        int lanes = active;
+
+        while (true)
+        {
+            const LinearBVHNode &node = nodes[current];
+            int node_lanes = node.box().hit(p) & lanes;
+            steps++;
+            if (node_lanes)
+            {
+                if (node.is_leaf())
+                {
+                    prim_tests += node.n_primitives;
+                    int leaf_hits = hit_leaf(p, node.primitives_offset, node.primitives_offset + node.n_primitives,
+                                             node_lanes, recs);
+
+                    for (int k = 0; k < ray_packet::WIDTH; k++)
+                    {
+                        if (!(leaf_hits >> k & 1) || recs[k].bvh_info)
+                            continue;
+                        recs[k].bvh_info = &node_info[current];
+                    }
+                    hits |= leaf_hits;
+
+                    if (to_visit_offset == 0)
+                        break;
+                    to_visit_offset--;
+                    current = to_visit[to_visit_offset].node;
+                    lanes = to_visit[to_visit_offset].lanes;
+                }
+                else
+                {
+                    if (lead_ray.sign(node.axis))
+                    {
+                        to_visit[to_visit_offset++] = {current + 1, node_lanes};
+                        current = node.second_child_offset;
+                    }
+                    else
+                    {
+                        to_visit[to_visit_offset++] = {node.second_child_offset, node_lanes};
+                        current = current + 1;
+                    }
+                    lanes = node_lanes;
+                }
+            }
+            else
+            {
+                if (to_visit_offset == 0)
+                    break;
+                to_visit_offset--;
+                current = to_visit[to_visit_offset].node;
+                lanes = to_visit[to_visit_offset].lanes;
+            }
+        }
 
-        return hit_left || hit_right;
+        stats.add(__builtin_popcount(active), steps, prim_tests);
+        return hits;
     }
 
     bbox get_bbox() const override
     {
-        return b;
+        if (nodes.empty())
+            return bbox::empty;
+        return nodes[0].box();
     }
 
 private:
-    // Median split helper function
-    void middle_split(std::vector<shared_ptr<hittable>> &objects,
-                      size_t start, size_t end,
-                      int axis, size_t &split_pos)
+    // Exact types only: a subclass may override hit() or resolve()
+    static BVHPrimType prim_type_of(const hittable *prim)
     {
-        auto comparator = (axis == 0)   ? box_x_compare
-                          : (axis == 1) ? box_y_compare
-                                        : box_z_compare;
+        if (typeid(*prim) == typeid(sphere))
+            return BVHPrimType::SPHERE;
+        if (typeid(*prim) == typeid(triangle))
+            return BVHPrimType::TRIANGLE;
+        return BVHPrimType::HITTABLE;
+    }
 
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
-        split_pos = start + (end - start) / 2;
+    // Copy the sphere and triangle geometry into the packed arrays and tag the leaves
+    // Runs again on refit, since moving the objects changes their geometry.
+    void pack_primitives(bool parallel = true)
+    {
+        size_t n = primitives.size();
+        if (n == 0)
+            return;
+        prim_index.resize(n);
+
+        // Each packed array keeps the leaf order of its type
+        size_t n_spheres = 0, n_triangles = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (prim_types[i] == uint8_t(BVHPrimType::SPHERE))
+                prim_index[i] = uint32_t(n_spheres++);
+            else if (prim_types[i] == uint8_t(BVHPrimType::TRIANGLE))
+                prim_index[i] = uint32_t(n_triangles++);
+            else
+                prim_index[i] = 0;
+        }
+        spheres.resize(n_spheres);
+        triangles.resize(n_triangles);
+
+#pragma omp parallel for if (parallel)
+        for (size_t i = 0; i < n; i++)
+        {
+            const hittable *prim = primitives[i].get();
+            if (prim_types[i] == uint8_t(BVHPrimType::SPHERE))
+            {
+                auto s = static_cast<const sphere *>(prim);
+                spheres[prim_index[i]] = {s->get_center(), s->get_radius()};
+            }
+            else if (prim_types[i] == uint8_t(BVHPrimType::TRIANGLE))
+            {
+                const vertex *v = static_cast<const triangle *>(prim)->vertices;
+                triangles[prim_index[i]] = {v[0].pos, v[1].pos - v[0].pos, v[2].pos - v[0].pos};
+            }
+        }
+
+#pragma omp parallel for if (parallel)
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            LinearBVHNode &node = nodes[i];
+            if (!node.is_leaf())
+                continue;
+            uint8_t first = prim_types[node.primitives_offset];
+            uint8_t last = prim_types[node.primitives_offset + node.n_primitives - 1];
+            node.prim_type = first == last ? first : uint8_t(BVHPrimType::MIXED);
+        }
     }
 
-    // SAH split attempt helper function
-    bool try_sah_split(std::vector<shared_ptr<hittable>> &objects,
-                       size_t start, size_t end,
-                       int &best_axis, size_t &best_split_pos)
+    // One run of primitives of the same type
+    bool hit_run(const ray &r, BVHPrimType type, int first, int end, interval &t, hit_record &rec) const
     {
-        constexpr int SAH_BUCKETS = 12;
-        constexpr float COST_TRAVERSAL = 2.0f; // Cost of traversing both children
-        constexpr float COST_INTERSECTION = 1;
-        int BUCKETS_SIZE = int((end - start) / SAH_BUCKETS) + 1;
+        bool hit_anything = false;
+        switch (type)
+        {
+        case BVHPrimType::SPHERE:
+        {
+            const SpherePrim *s = &spheres[prim_index[first]];
+            for (int i = 0; i < end - first; i++)
+            {
+                real t_hit;
+                if (intersect_sphere(r, s[i].center, s[i].radius, t, t_hit))
+                {
+                    hit_anything = true;
+                    t.max = t_hit;
+                    rec.set_hit(t_hit, primitives[first + i].get());
+                }
+            }
+            break;
+        }
+        case BVHPrimType::TRIANGLE:
+        {
+            const TrianglePrim *tri = &triangles[prim_index[first]];
+            for (int i = 0; i < end - first; i++)
+            {
+                real t_hit, b1, b2;
+                if (intersect_triangle_edges(r, tri[i].p0, tri[i].e1, tri[i].e2, t, t_hit, b1, b2))
+                {
+                    hit_anything = true;
+                    t.max = t_hit;
+                    rec.set_hit(t_hit, primitives[first + i].get(), 0, b1, b2);
+                }
+            }
+            break;
+        }
+        default:
+            for (int i = first; i < end; i++)
+            {
+                hit_record prim_rec;
+                if (primitives[i]->hit(r, t, prim_rec))
+                {
+                    hit_anything = true;
+                    t.max = prim_rec.t;
+                    rec = prim_rec;
+                }
+            }
+        }
+        return hit_anything;
+    }
 
-        struct BucketInfo
+    // Any-hit version of hit_run
+    bool occluded_run(const ray &r, BVHPrimType type, int first, int end, const interval &t) const
+    {
+        switch (type)
         {
-            int count = 0;
-            bbox bounds = bbox::empty;
-        };
+        case BVHPrimType::SPHERE:
+        {
+            const SpherePrim *s = &spheres[prim_index[first]];
+            for (int i = 0; i < end - first; i++)
+            {
+                real t_hit;
+                if (intersect_sphere(r, s[i].center, s[i].radius, t, t_hit))
+                    return true;
+            }
+            return false;
+        }
+        case BVHPrimType::TRIANGLE:
+        {
+            const TrianglePrim *tri = &triangles[prim_index[first]];
+            for (int i = 0; i < end - first; i++)
+            {
+                real t_hit, b1, b2;
+                if (intersect_triangle_edges(r, tri[i].p0, tri[i].e1, tri[i].e2, t, t_hit, b1, b2))
+                    return true;
+            }
+            return false;
+        }
+        default:
+            for (int i = first; i < end; i++)
+            {
+                if (primitives[i]->occluded(r, t))
+                    return true;
+            }
+            return false;
+        }
+    }
 
-        float min_cost = std::numeric_limits<float>::max();
-        bool found_good_split = false;
+    // Packet version of hit_leaf, spheres are tested lane by lane
+    int hit_leaf(ray_packet &p, int first, int end, int active, hit_record *recs) const
+    {
+        int hits = 0;
+        for (int i = first; i < end; i++)
+        {
+            switch (BVHPrimType(prim_types[i]))
+            {
+            case BVHPrimType::SPHERE:
+            {
+                const SpherePrim &s = spheres[prim_index[i]];
+                for (int k = 0; k < ray_packet::WIDTH; k++)
+                {
+                    real t_hit;
+                    if ((active >> k & 1) && intersect_sphere(p.rays[k], s.center, s.radius, p.lane_interval(k), t_hit))
+                    {
+                        recs[k].set_hit(t_hit, primitives[i].get());
+                        p.t_max[k] = t_hit;
+                        hits |= 1 << k;
+                    }
+                }
+                break;
+            }
+            case BVHPrimType::TRIANGLE:
+            {
+                const TrianglePrim &tri = triangles[prim_index[i]];
+                double4 t, b1, b2;
+                int tri_hits = intersect_triangle_edges(p, active, tri.p0, tri.e1, tri.e2, t, b1, b2);
+                for (int k = 0; k < ray_packet::WIDTH; k++)
+                {
+                    if (!(tri_hits >> k & 1))
+                        continue;
+                    recs[k].set_hit(t[k], primitives[i].get(), 0, b1[k], b2[k]);
+                    p.t_max[k] = t[k];
+                }
+                hits |= tri_hits;
+                break;
+            }
+            default:
+                hits |= primitives[i]->hit(p, active, recs);
+            }
+        }
+        return hits;
+    }
 
-        for (size_t axis = 0; axis < 3; axis++)
+    // Build the linear nodes over `info`, reordered into leaf order
+    void build_nodes(std::vector<BVHPrimitiveInfo> &info, int max_leaf_size,
+                     BVHSplitMethod split_method, bool parallel)
+    {
+        // Subtrees are built as tasks into a temporary tree. Every split only
+        // depends on its own range, so the tree is the same for any thread count.
+        std::unique_ptr<BVHBuildNode> root;
+        max_leaf_size = std::min(max_leaf_size, MAX_LEAF_PRIMS);
+#pragma omp parallel if (parallel)
+#pragma omp single
         {
-            BucketInfo buckets[SAH_BUCKETS];
-            auto comparator = (axis == 0)   ? box_x_compare
-                              : (axis == 1) ? box_y_compare
-                                            : box_z_compare;
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
+            if (split_method == BVHSplitMethod::LBVH || split_method == BVHSplitMethod::HLBVH)
+                root = build_lbvh(info, max_leaf_size, split_method == BVHSplitMethod::HLBVH);
+            else
+                root = build(info, 0, info.size(), max_leaf_size, split_method, 0);
+        }
+
+        // Flatten in depth-first order
+        nodes.reserve(2 * info.size());
+        node_info.reserve(2 * info.size());
+        std::string path;
+        flatten(root.get(), 0, path);
+
+        build_cost = sah_cost();
+    }
 
-            // Fill buckets
-            for (size_t i = start; i < end; ++i)
+    // Leaf primitive counts are stored in 16 bits
+    static constexpr int MAX_LEAF_PRIMS = UINT16_MAX;
+    // Depth from which build() forces leaves; the midpoint splits of a forced
+    // range of up to MAX_LEAF_PRIMS * 2^16 primitives stay within MAX_STACK_DEPTH
+    static constexpr int FORCED_LEAF_DEPTH = MAX_STACK_DEPTH - 16;
+    // Subtrees above this size are built as separate tasks
+    static constexpr size_t PARALLEL_TASK_CUTOFF = 4096;
+    // Ranges above this size are scanned (bounds, bins and partitions) in parallel chunks
+    static constexpr size_t PARALLEL_SCAN_CUTOFF = 65536;
+    static constexpr int SAH_BINS = 16;
+    // Morton code layout: 10 bits per axis, sorted in three 10-bit radix passes
+    static constexpr int MORTON_BITS = 30;
+    static constexpr int RADIX_BITS = 10;
+    // HLBVH treelets share the top bits of their Morton codes
+    static constexpr int TREELET_BITS = 12;
+    // Below this depth the HLBVH upper tree falls back to median splits
+    static constexpr int UPPER_SAH_MAX_DEPTH = 32;
+
+    struct BinInfo
+    {
+        int count = 0;
+        bbox bounds = bbox::empty;
+    };
+
+    // Recursive construction into a temporary tree
+    std::unique_ptr<BVHBuildNode> build(std::vector<BVHPrimitiveInfo> &info,
+                                        size_t start, size_t end,
+                                        int max_leaf_size,
+                                        BVHSplitMethod split_method,
+                                        int depth)
+    {
+        // Near the traversal stack limit the rest of the range becomes leaves,
+        // halved at the midpoint until each fits the 16-bit primitive count
+        bool forced = depth >= FORCED_LEAF_DEPTH;
+        if (forced)
+        {
+            if (depth == FORCED_LEAF_DEPTH)
             {
-                int bucket_idx = int((i - start) / BUCKETS_SIZE);
-                buckets[bucket_idx].count++;
-                buckets[bucket_idx].bounds = bbox(buckets[bucket_idx].bounds, objects[i]->get_bbox());
+#pragma omp critical
+                std::cerr << "Error: BVH depth exceeds " << FORCED_LEAF_DEPTH << ", leaves forced." << std::endl;
             }
+            max_leaf_size = MAX_LEAF_PRIMS;
+        }
 
-            // Calculate cost for each split position
-            for (int i = 1; i < SAH_BUCKETS; ++i)
+        auto node = std::make_unique<BVHBuildNode>();
+        node->first_prim = start;
+        node->n_prims = end - start;
+
+        // 1. Compute current node's bounding box and the bounds of the centroids
+        bbox centroid_bounds;
+        compute_bounds(info, start, end, node->bounds, centroid_bounds);
+
+        // 2. Check recursion termination condition
+        size_t object_count = end - start;
+        if (object_count <= size_t(max_leaf_size))
+            return node;
+
+        // 3. Choose splitting method based on strategy
+        size_t split_pos = start;
+        int split_axis = centroid_bounds.longest_axis();
+
+        if (forced || centroid_bounds.get(split_axis).size() <= 0)
+        {
+            // All centroids coincide (or the leaf is forced), any split is as good as another
+            split_pos = start + object_count / 2;
+        }
+        else if (split_method == BVHSplitMethod::SAH)
+        {
+            // Try SAH split first, fall back to median if fails
+            if (!binned_sah_split(info, start, end, centroid_bounds, split_axis, split_pos))
             {
-                bbox left_box = bbox::empty, right_box = bbox::empty;
-                int left_count = 0, right_count = 0;
+                split_axis = centroid_bounds.longest_axis();
+                middle_split(info, start, end, split_axis, split_pos);
+            }
+        }
+        else
+        {
+            // Always use median split
+            middle_split(info, start, end, split_axis, split_pos);
+        }
 
-                // Calculate left side
-                for (int j = 0; j < i; ++j)
+        // 4. Recursively build child nodes (maintain same splitting strategy)
+        node->split_axis = split_axis;
+        BVHBuildNode *n = node.get();
+        if (object_count > PARALLEL_TASK_CUTOFF)
+        {
+#pragma omp task shared(info) firstprivate(n, start, split_pos, max_leaf_size, split_method, depth)
+            n->children[0] = build(info, start, split_pos, max_leaf_size, split_method, depth + 1);
+            n->children[1] = build(info, split_pos, end, max_leaf_size, split_method, depth + 1);
+#pragma omp taskwait
+        }
+        else
+        {
+            n->children[0] = build(info, start, split_pos, max_leaf_size, split_method, depth + 1);
+            n->children[1] = build(info, split_pos, end, max_leaf_size, split_method, depth + 1);
+        }
+        return node;
+    }
+
+    // Linear BVH construction
+    // Primitives are sorted along a Morton curve, then each node splits its
+    // range where the highest differing code bit flips. With `sah_upper` the
+    // ranges sharing the top TREELET_BITS become treelets, and an SAH tree is
+    // built over the treelet roots to recover most of the SAH trace speed.
+    std::unique_ptr<BVHBuildNode> build_lbvh(std::vector<BVHPrimitiveInfo> &info,
+                                             int max_leaf_size, bool sah_upper)
+    {
+        size_t n = info.size();
+        bbox bounds, centroid_bounds;
+        compute_bounds(info, 0, n, bounds, centroid_bounds);
+
+        // 1. Morton codes of the centroids, quantized to 1024 steps per axis
+        std::vector<MortonPrimitive> morton(n);
+        int n_chunks = scan_chunks(0, n);
+        for (int c = 0; c < n_chunks; c++)
+        {
+#pragma omp task shared(info, morton, centroid_bounds) firstprivate(c) if (n_chunks > 1)
+            {
+                size_t chunk_end = chunk_begin(0, n, c + 1, n_chunks);
+                for (size_t i = chunk_begin(0, n, c, n_chunks); i < chunk_end; i++)
                 {
-                    left_box = bbox(left_box, buckets[j].bounds);
-                    left_count += buckets[j].count;
+                    uint32_t q[3];
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        const interval &extent = centroid_bounds.get(axis);
+                        double f = extent.size() > 0 ? (info[i].centroid[axis] - extent.min) / extent.size() : 0;
+                        q[axis] = uint32_t(std::clamp(int(f * 1024), 0, 1023));
+                    }
+                    morton[i] = {left_shift3(q[0]) << 2 | left_shift3(q[1]) << 1 | left_shift3(q[2]), uint32_t(i)};
                 }
+            }
+        }
+#pragma omp taskwait
+
+        // 2. Sort and reorder the primitives along the curve
+        radix_sort(morton);
+        std::vector<BVHPrimitiveInfo> sorted(n);
+        for (int c = 0; c < n_chunks; c++)
+        {
+#pragma omp task shared(info, morton, sorted) firstprivate(c) if (n_chunks > 1)
+            {
+                size_t chunk_end = chunk_begin(0, n, c + 1, n_chunks);
+                for (size_t i = chunk_begin(0, n, c, n_chunks); i < chunk_end; i++)
+                    sorted[i] = info[morton[i].index];
+            }
+        }
+#pragma omp taskwait
+        info.swap(sorted);
+
+        // 3. Emit the hierarchy
+        if (!sah_upper)
+            return emit_lbvh(info, morton, 0, n, max_leaf_size, MORTON_BITS - 1);
+
+        const int treelet_shift = MORTON_BITS - TREELET_BITS;
+        std::vector<std::pair<size_t, size_t>> ranges;
+        for (size_t start = 0, end = 1; end <= n; end++)
+        {
+            if (end == n || morton[end].code >> treelet_shift != morton[start].code >> treelet_shift)
+            {
+                ranges.push_back({start, end});
+                start = end;
+            }
+        }
+
+        std::vector<std::unique_ptr<BVHBuildNode>> treelets(ranges.size());
+        for (size_t t = 0; t < ranges.size(); t++)
+        {
+#pragma omp task shared(info, morton, ranges, treelets) firstprivate(t, max_leaf_size) if (ranges[t].second - ranges[t].first > PARALLEL_TASK_CUTOFF)
+            treelets[t] = emit_lbvh(info, morton, ranges[t].first, ranges[t].second,
+                                    max_leaf_size, treelet_shift - 1);
+        }
+#pragma omp taskwait
+
+        // Treelet roots take the place of primitives for the upper build
+        std::vector<BVHPrimitiveInfo> roots(treelets.size());
+        for (size_t t = 0; t < treelets.size(); t++)
+            roots[t] = {t, treelets[t]->bounds, treelets[t]->bounds.centroid()};
+        return build_upper(roots, treelets, 0, roots.size(), 0);
+    }
+
+    // Split a Morton-sorted range at the first code with `bit` set
+    std::unique_ptr<BVHBuildNode> emit_lbvh(const std::vector<BVHPrimitiveInfo> &info,
+                                            const std::vector<MortonPrimitive> &morton,
+                                            size_t start, size_t end,
+                                            int max_leaf_size, int bit)
+    {
+        auto node = std::make_unique<BVHBuildNode>();
+        node->first_prim = start;
+        node->n_prims = end - start;
+
+        size_t object_count = end - start;
+        if (object_count <= size_t(max_leaf_size))
+        {
+            node->bounds = bbox::empty;
+            for (size_t i = start; i < end; i++)
+                node->bounds = bbox(node->bounds, info[i].bounds);
+            return node;
+        }
+
+        // Skip bits shared by the whole range
+        const uint32_t first = morton[start].code, last = morton[end - 1].code;
+        while (bit >= 0 && ((first ^ last) >> bit & 1) == 0)
+            bit--;
 
-                // Calculate right side
-                for (int j = i; j < SAH_BUCKETS; ++j)
+        size_t split_pos;
+        if (bit >= 0)
+        {
+            uint32_t mask = 1u << bit;
+            split_pos = size_t(std::partition_point(morton.begin() + start, morton.begin() + end,
+                                                    [mask](const MortonPrimitive &m)
+                                                    { return (m.code & mask) == 0; }) -
+                               morton.begin());
+            node->split_axis = 2 - bit % 3;
+        }
+        else
+        {
+            // Identical codes, split in the middle
+            split_pos = start + object_count / 2;
+            node->split_axis = 0;
+        }
+
+        BVHBuildNode *nd = node.get();
+        if (object_count > PARALLEL_TASK_CUTOFF)
+        {
+#pragma omp task shared(info, morton) firstprivate(nd, start, split_pos, max_leaf_size, bit)
+            nd->children[0] = emit_lbvh(info, morton, start, split_pos, max_leaf_size, bit - 1);
+            nd->children[1] = emit_lbvh(info, morton, split_pos, end, max_leaf_size, bit - 1);
+#pragma omp taskwait
+        }
+        else
+        {
+            nd->children[0] = emit_lbvh(info, morton, start, split_pos, max_leaf_size, bit - 1);
+            nd->children[1] = emit_lbvh(info, morton, split_pos, end, max_leaf_size, bit - 1);
+        }
+        node->bounds = bbox(node->children[0]->bounds, node->children[1]->bounds);
+        return node;
+    }
+
+    // SAH tree over the HLBVH treelet roots
+    std::unique_ptr<BVHBuildNode> build_upper(std::vector<BVHPrimitiveInfo> &roots,
+                                              std::vector<std::unique_ptr<BVHBuildNode>> &treelets,
+                                              size_t start, size_t end, int depth)
+    {
+        if (end - start == 1)
+            return std::move(treelets[roots[start].index]);
+
+        auto node = std::make_unique<BVHBuildNode>();
+        bbox centroid_bounds;
+        compute_bounds(roots, start, end, node->bounds, centroid_bounds);
+
+        size_t split_pos = start;
+        int split_axis = centroid_bounds.longest_axis();
+        if (centroid_bounds.get(split_axis).size() <= 0)
+            split_pos = start + (end - start) / 2;
+        else if (depth >= UPPER_SAH_MAX_DEPTH ||
+                 !binned_sah_split(roots, start, end, centroid_bounds, split_axis, split_pos))
+        {
+            split_axis = centroid_bounds.longest_axis();
+            middle_split(roots, start, end, split_axis, split_pos);
+        }
+
+        node->split_axis = split_axis;
+        node->children[0] = build_upper(roots, treelets, start, split_pos, depth + 1);
+        node->children[1] = build_upper(roots, treelets, split_pos, end, depth + 1);
+        return node;
+    }
+
+    // Stable LSD radix sort by Morton code
+    // Chunks are histogrammed in parallel and scatter to offsets ordered by
+    // (bucket, chunk), so the result does not depend on the thread count.
+    static void radix_sort(std::vector<MortonPrimitive> &v)
+    {
+        constexpr int N_BUCKETS = 1 << RADIX_BITS;
+        std::vector<MortonPrimitive> tmp(v.size());
+        int n_chunks = scan_chunks(0, v.size());
+        std::vector<std::array<size_t, N_BUCKETS>> offsets(n_chunks);
+
+        for (int low_bit = 0; low_bit < MORTON_BITS; low_bit += RADIX_BITS)
+        {
+            // 1. Count bucket sizes per chunk
+            for (int c = 0; c < n_chunks; c++)
+            {
+#pragma omp task shared(v, offsets) firstprivate(c, low_bit) if (n_chunks > 1)
                 {
-                    right_box = bbox(right_box, buckets[j].bounds);
-                    right_count += buckets[j].count;
+                    offsets[c].fill(0);
+                    size_t chunk_end = chunk_begin(0, v.size(), c + 1, n_chunks);
+                    for (size_t i = chunk_begin(0, v.size(), c, n_chunks); i < chunk_end; i++)
+                        offsets[c][v[i].code >> low_bit & (N_BUCKETS - 1)]++;
                 }
+            }
+#pragma omp taskwait
 
-                // Calculate cost (avoid division by zero and invalid boxes)
-                float left_area = left_box.surface_area();
-                float right_area = right_box.surface_area();
-                float total_area = b.surface_area();
+            // 2. Exclusive prefix sum
+            size_t offset = 0;
+            for (int b = 0; b < N_BUCKETS; b++)
+            {
+                for (int c = 0; c < n_chunks; c++)
+                {
+                    size_t count = offsets[c][b];
+                    offsets[c][b] = offset;
+                    offset += count;
+                }
+            }
+
+            // 3. Scatter
+            for (int c = 0; c < n_chunks; c++)
+            {
+#pragma omp task shared(v, tmp, offsets) firstprivate(c, low_bit) if (n_chunks > 1)
+                {
+                    size_t chunk_end = chunk_begin(0, v.size(), c + 1, n_chunks);
+                    for (size_t i = chunk_begin(0, v.size(), c, n_chunks); i < chunk_end; i++)
+                        tmp[offsets[c][v[i].code >> low_bit & (N_BUCKETS - 1)]++] = v[i];
+                }
+            }
+#pragma omp taskwait
+            v.swap(tmp);
+        }
+    }
+
+    // Spread the lower 10 bits of x so two zero bits separate each bit
+    static uint32_t left_shift3(uint32_t x)
+    {
+        x = (x | (x << 16)) & 0x030000FF;
+        x = (x | (x << 8)) & 0x0300F00F;
+        x = (x | (x << 4)) & 0x030C30C3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    }
+
+    // Emit the temporary tree as linear nodes, returns the index of `node`
+    // `path` is the node's BVH path, extended in place for the children
+    int flatten(const BVHBuildNode *node, int depth, std::string &path)
+    {
+        int node_index = int(nodes.size());
+        nodes.emplace_back();
+        node_info.push_back({depth, path});
+        set_bounds(nodes[node_index], node->bounds);
+
+        if (!node->children[0])
+        {
+            if (node->n_prims > size_t(MAX_LEAF_PRIMS))
+            {
+                std::cerr << "Error: BVH leaf of " << node->n_prims << " primitives exceeds "
+                          << MAX_LEAF_PRIMS << ", primitives dropped." << std::endl;
+            }
+            nodes[node_index].primitives_offset = int(node->first_prim);
+            nodes[node_index].n_primitives = uint16_t(std::min(node->n_prims, size_t(MAX_LEAF_PRIMS)));
+            return node_index;
+        }
 
-                float cost = COST_TRAVERSAL + (left_count * left_area + right_count * right_area) / (total_area + 1e-8) * COST_INTERSECTION;
+        // The first child is emitted right after this node
+        path.push_back('0');
+        flatten(node->children[0].get(), depth + 1, path);
+        path.back() = '1';
+        int second_child = flatten(node->children[1].get(), depth + 1, path);
+        path.pop_back();
 
-                // Update best split
-                if (cost < min_cost && left_count > 0 && right_count > 0)
+        nodes[node_index].second_child_offset = second_child;
+        nodes[node_index].n_primitives = 0;
+        nodes[node_index].axis = uint8_t(node->split_axis);
+        return node_index;
+    }
+
+    // Split [start, end) into chunks for the parallel scans of large ranges
+    static int scan_chunks(size_t start, size_t end)
+    {
+        size_t count = end - start;
+        if (count <= PARALLEL_SCAN_CUTOFF)
+            return 1;
+        return int(std::min<size_t>(count / (PARALLEL_SCAN_CUTOFF / 4), 64));
+    }
+
+    static size_t chunk_begin(size_t start, size_t end, int chunk, int n_chunks)
+    {
+        return start + (end - start) * chunk / n_chunks;
+    }
+
+    // Stable partition of [start, end) by classify(p) in [0, N_CLASSES)
+    // Like radix_sort: chunks are counted in parallel and scatter to offsets
+    // ordered by (class, chunk), so the order does not depend on the thread
+    // count. Returns the end of each class.
+    template <int N_CLASSES, typename Classify>
+    static std::array<size_t, N_CLASSES> partition_chunks(std::vector<BVHPrimitiveInfo> &info,
+                                                          size_t start, size_t end, Classify classify)
+    {
+        int n_chunks = scan_chunks(start, end);
+        std::vector<std::array<size_t, N_CLASSES>> offsets(n_chunks);
+        std::vector<BVHPrimitiveInfo> tmp(end - start);
+
+        // 1. Count class sizes per chunk
+        for (int c = 0; c < n_chunks; c++)
+        {
+#pragma omp task shared(info, offsets, classify) firstprivate(c) if (n_chunks > 1)
+            {
+                offsets[c].fill(0);
+                size_t chunk_end = chunk_begin(start, end, c + 1, n_chunks);
+                for (size_t i = chunk_begin(start, end, c, n_chunks); i < chunk_end; i++)
+                    offsets[c][classify(info[i])]++;
+            }
+        }
+#pragma omp taskwait
+
+        // 2. Exclusive prefix sum
+        std::array<size_t, N_CLASSES> class_end;
+        size_t offset = 0;
+        for (int k = 0; k < N_CLASSES; k++)
+        {
+            for (int c = 0; c < n_chunks; c++)
+            {
+                size_t count = offsets[c][k];
+                offsets[c][k] = offset;
+                offset += count;
+            }
+            class_end[k] = start + offset;
+        }
+
+        // 3. Scatter, then copy back
+        for (int c = 0; c < n_chunks; c++)
+        {
+#pragma omp task shared(info, tmp, offsets, classify) firstprivate(c) if (n_chunks > 1)
+            {
+                size_t chunk_end = chunk_begin(start, end, c + 1, n_chunks);
+                for (size_t i = chunk_begin(start, end, c, n_chunks); i < chunk_end; i++)
+                    tmp[offsets[c][classify(info[i])]++] = info[i];
+            }
+        }
+#pragma omp taskwait
+        for (int c = 0; c < n_chunks; c++)
+        {
+#pragma omp task shared(info, tmp) firstprivate(c) if (n_chunks > 1)
+            std::copy(tmp.begin() + (chunk_begin(start, end, c, n_chunks) - start),
+                      tmp.begin() + (chunk_begin(start, end, c + 1, n_chunks) - start),
+                      info.begin() + chunk_begin(start, end, c, n_chunks));
+        }
+#pragma omp taskwait
+        return class_end;
+    }
+
+    // Bounds of the primitives and of their centroids
+    // Box unions are exact, so merging the chunks in any order gives the same result
+    static void compute_bounds(const std::vector<BVHPrimitiveInfo> &info,
+                               size_t start, size_t end,
+                               bbox &bounds, bbox &centroid_bounds)
+    {
+        int n_chunks = scan_chunks(start, end);
+        std::vector<bbox> chunk_bounds(n_chunks, bbox::empty);
+        std::vector<bbox> chunk_centroids(n_chunks, bbox::empty);
+
+        for (int c = 0; c < n_chunks; c++)
+        {
+#pragma omp task shared(info, chunk_bounds, chunk_centroids) firstprivate(c) if (n_chunks > 1)
+            {
+                size_t chunk_end = chunk_begin(start, end, c + 1, n_chunks);
+                for (size_t i = chunk_begin(start, end, c, n_chunks); i < chunk_end; i++)
                 {
-                    min_cost = cost;
-                    best_axis = axis;
-                    best_split_pos = start + left_count; // Actual object count
-                    found_good_split = true;
+                    chunk_bounds[c] = bbox(chunk_bounds[c], info[i].bounds);
+                    chunk_centroids[c] = bbox(chunk_centroids[c], info[i].centroid);
                 }
             }
         }
+#pragma omp taskwait
 
-        // Apply sorting only if good split was found
-        if (found_good_split)
+        bounds = bbox::empty;
+        centroid_bounds = bbox::empty;
+        for (int c = 0; c < n_chunks; c++)
         {
-            auto comparator = (best_axis == 0)   ? box_x_compare
-                              : (best_axis == 1) ? box_y_compare
-                                                 : box_z_compare;
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
+            bounds = bbox(bounds, chunk_bounds[c]);
+            centroid_bounds = bbox(centroid_bounds, chunk_centroids[c]);
         }
+    }
 
-        return found_good_split;
+    // Store double bounds as floats, rounded outwards so the box never shrinks
+    static void set_bounds(LinearBVHNode &node, const bbox &b)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            interval axis = b.get(i);
+            float lo = float(axis.min);
+            float hi = float(axis.max);
+            if (lo > axis.min)
+                lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+            if (hi < axis.max)
+                hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+            node.bounds[0][i] = lo;
+            node.bounds[1][i] = hi;
+        }
     }
 
-    // Comparison functions
-    static bool box_x_compare(const shared_ptr<hittable> a,
-                              const shared_ptr<hittable> b)
+    // Median split helper function, O(n) selection of the median centroid
+    // Large ranges are narrowed by quickselect steps with a parallel three-way
+    // partition around a median-of-three pivot, the rest by std::nth_element.
+    static void middle_split(std::vector<BVHPrimitiveInfo> &info,
+                             size_t start, size_t end,
+                             int axis, size_t &split_pos)
     {
-        return a->get_bbox().x.min < b->get_bbox().x.min;
+        split_pos = start + (end - start) / 2;
+        size_t lo = start, hi = end;
+        while (hi - lo > PARALLEL_SCAN_CUTOFF)
+        {
+            double a = info[lo].centroid[axis];
+            double b = info[lo + (hi - lo) / 2].centroid[axis];
+            double c = info[hi - 1].centroid[axis];
+            double pivot = std::max(std::min(a, b), std::min(std::max(a, b), c));
+            auto ends = partition_chunks<3>(info, lo, hi,
+                                            [axis, pivot](const BVHPrimitiveInfo &p)
+                                            { return p.centroid[axis] < pivot ? 0 : p.centroid[axis] == pivot ? 1 : 2; });
+            if (split_pos >= ends[0] && split_pos < ends[1])
+                return; // The median equals the pivot
+            if (ends[0] == lo && ends[1] == lo)
+                break; // No progress, e.g. a NaN pivot
+            if (split_pos < ends[0])
+                hi = ends[0];
+            else
+                lo = ends[1];
+        }
+        std::nth_element(info.begin() + lo, info.begin() + split_pos, info.begin() + hi,
+                         [axis](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b)
+                         { return a.centroid[axis] < b.centroid[axis]; });
     }
 
-    static bool box_y_compare(const shared_ptr<hittable> a,
-                              const shared_ptr<hittable> b)
+    // Binned SAH split helper function
+    // Centroids are binned along each axis in one pass, the best plane between
+    // bins is found with prefix/suffix sweeps and the range is partitioned in place.
+    static bool binned_sah_split(std::vector<BVHPrimitiveInfo> &info,
+                                 size_t start, size_t end,
+                                 const bbox &centroid_bounds,
+                                 int &best_axis, size_t &best_split_pos)
     {
-        return a->get_bbox().y.min < b->get_bbox().y.min;
+        // Fill bins of all three axes, large ranges in parallel chunks
+        int n_chunks = scan_chunks(start, end);
+        std::vector<std::array<std::array<BinInfo, SAH_BINS>, 3>> chunk_bins(n_chunks);
+        for (int c = 0; c < n_chunks; c++)
+        {
+#pragma omp task shared(info, chunk_bins, centroid_bounds) firstprivate(c) if (n_chunks > 1)
+            {
+                size_t chunk_end = chunk_begin(start, end, c + 1, n_chunks);
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    const interval &extent = centroid_bounds.get(axis);
+                    if (extent.size() <= 0)
+                        continue;
+                    double scale = SAH_BINS / extent.size();
+                    auto &bins = chunk_bins[c][axis];
+                    for (size_t i = chunk_begin(start, end, c, n_chunks); i < chunk_end; i++)
+                    {
+                        int bin = bin_index(info[i].centroid[axis], extent.min, scale);
+                        bins[bin].count++;
+                        bins[bin].bounds = bbox(bins[bin].bounds, info[i].bounds);
+                    }
+                }
+            }
+        }
+#pragma omp taskwait
+
+        double min_cost = std::numeric_limits<double>::max();
+        int best_bin = -1;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval &extent = centroid_bounds.get(axis);
+            if (extent.size() <= 0)
+                continue;
+
+            // Merge the chunks (counts and box unions are order independent)
+            BinInfo bins[SAH_BINS];
+            for (int c = 0; c < n_chunks; c++)
+            {
+                for (int i = 0; i < SAH_BINS; i++)
+                {
+                    bins[i].count += chunk_bins[c][axis][i].count;
+                    bins[i].bounds = bbox(bins[i].bounds, chunk_bins[c][axis][i].bounds);
+                }
+            }
+
+            // Sweep from the right to get the area and count right of each plane
+            double right_area[SAH_BINS];
+            int right_count[SAH_BINS];
+            bbox right_box = bbox::empty;
+            int count = 0;
+            for (int i = SAH_BINS - 1; i > 0; i--)
+            {
+                right_box = bbox(right_box, bins[i].bounds);
+                count += bins[i].count;
+                right_area[i] = right_box.surface_area();
+                right_count[i] = count;
+            }
+
+            // Sweep from the left and evaluate the plane between bins i-1 and i
+            bbox left_box = bbox::empty;
+            int left_count = 0;
+            for (int i = 1; i < SAH_BINS; i++)
+            {
+                left_box = bbox(left_box, bins[i - 1].bounds);
+                left_count += bins[i - 1].count;
+                if (left_count == 0 || right_count[i] == 0)
+                    continue;
+
+                // Traversal cost is the same for every candidate, only the child terms matter
+                double cost = left_count * left_box.surface_area() + right_count[i] * right_area[i];
+                if (cost < min_cost)
+                {
+                    min_cost = cost;
+                    best_axis = axis;
+                    best_bin = i;
+                }
+            }
+        }
+
+        if (best_bin < 0)
+            return false;
+
+        // Partition the range by the winning plane
+        const interval &extent = centroid_bounds.get(best_axis);
+        double scale = SAH_BINS / extent.size();
+        int axis = best_axis;
+        auto left_of_plane = [&](const BVHPrimitiveInfo &p)
+        { return bin_index(p.centroid[axis], extent.min, scale) < best_bin; };
+        if (scan_chunks(start, end) > 1)
+            best_split_pos = partition_chunks<2>(info, start, end,
+                                                 [&](const BVHPrimitiveInfo &p)
+                                                 { return left_of_plane(p) ? 0 : 1; })[0];
+        else
+            best_split_pos = size_t(std::partition(info.begin() + start, info.begin() + end, left_of_plane) - info.begin());
+        return best_split_pos > start && best_split_pos < end;
     }
 
-    static bool box_z_compare(const shared_ptr<hittable> a,
-                              const shared_ptr<hittable> b)
+    static int bin_index(double c, double min, double scale)
     {
-        return a->get_bbox().z.min < b->get_bbox().z.min;
+        int bin = int((c - min) * scale);
+        return bin < 0 ? 0 : bin >= SAH_BINS ? SAH_BINS - 1 : bin;
     }
 };
 
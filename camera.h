@@ -1,7 +1,38 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <condition_variable>
+#include <thread>
 #include "screen.h"
+#include "light.h"
+#include "film.h"
+#include "framebuffer.h"
+#include "denoiser.h"
+#include "tiles.h"
+
+// Render progress, counted by the worker threads and read by the presenting thread
+struct RenderProgress
+{
+    std::atomic<long long> done{0};     // Tiles finished, samples taken for adaptive renders
+    long long total = 0;                // `done` at the end of the render, set before it starts
+    std::atomic<int> pass{0};           // Current progressive pass or adaptive round
+    std::atomic<bool> aov_pass{false};  // Set once the image is done and the AOV tiles start
+    std::atomic<long long> aov_done{0}; // AOV tiles finished
+    long long aov_total = 0;            // `aov_done` at the end of the AOV pass
+    std::atomic<bool> finished{false};
+
+    std::mutex lock; // Only used to wake the presenting thread when the render ends
+    std::condition_variable wake;
+
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            finished = true;
+        }
+        wake.notify_all();
+    }
+};
 
 class camera
 {
@@ -22,53 +53,97 @@ public:
 
     double focus_dist = 10; // Distance from camera lookfrom point to plane of perfect focus
 
-    shared_ptr<material> mat = nullptr;
+    uint64_t seed = 42; // Frame seed, same seed gives the same image at any thread count
 
-    Screen screen;
+    bool use_packets = false; // Trace primary rays of 4 neighbouring pixels as one packet
 
-    void render(const hittable_list &world, bool display, bool use_openmp, bool use_sample_rate)
-    {
+    int russian_roulette = 3; // Bounces before paths may be terminated by Russian roulette, 0 = off
 
-#pragma omp parallel for schedule(dynamic) if (use_openmp)
-        for (int j = 0; j < image_height; j++)
-        {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; i++)
-            {
-                // Display a color gradient strip to help analyze BVH tree depth
-                // and see at what depth each pixel was hit
-                if (j < 10)
-                {
-                    screen.set_color(i, j, convert_int_to_color(i, image_width));
-                    continue;
-                }
+    light_list lights;       // Emitters sampled at diffuse hits
+    bool next_event = true;  // Sample lights directly and weight both strategies by MIS
 
-                vec3 pixel_color(0, 0, 0);
-                int current_samples_per_pixel = samples_per_pixel;
+    bool progressive = false; // Render one sample per pixel per pass, showing every pass
 
-                if (use_sample_rate)
-                {
-                    // Get first hit to determine sample rate
-                    hit_record rec;
-                    ray r = get_ray(i, j);
-                    bool hit_anything = world.hit(r, interval(0.001, infinity), rec);
-                    current_samples_per_pixel = hit_anything ? rec.mat->apply_sample_rate(samples_per_pixel) : samples_per_pixel;
-                }
+    double adaptive_threshold = 0; // Relative error pixels are sampled down to, 0 = fixed sample counts
 
-                for (int sample = 0; sample < current_samples_per_pixel; sample++)
-                {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
-                }
+    int tile_size = 32;    // Edge of the square tiles handed to the render threads
+    TileScheduler tiles;   // Tiles below the gradient strip, with their render times
 
-                screen.set_color(i, j, pixel_color / current_samples_per_pixel);
-            }
+    shared_ptr<material> mat = nullptr;
 
-            if (display && j > 0 && j % 10 == 0)
-                screen.display(1);
-        }
+    bool aovs = false;     // Capture first-hit albedo, normal and depth after the render
+    double exposure = 0;   // Exposure of the tone mapping pass in stops
+    bool reinhard = false; // Compress highlights instead of clipping them
+
+    Screen screen;
+    Film film;               // Linear sample sums, new samples continue after the ones already in it
+    FrameBuffer framebuffer; // Linear float mean of the film and the AOVs, tone mapped into screen
+
+    double display_fps = 10; // Rate the image and the progress line are refreshed at while rendering
+
+    RenderProgress progress;
+
+    // The render runs on its own thread, this thread only presents
+    // Worker threads just count finished work in `progress`, every frame the
+    // presenting thread prints the progress line and, with `display`, shows
+    // a preview. The preview copies only the tiles no worker is rendering
+    // from the film, busy tiles keep their last copy until the next frame.
+    void render(const hittable_list &world, bool display, bool use_openmp, bool use_sample_rate)
+    {
+        long long tile_count = tiles.tiles.size();
+        progress.done = 0;
+        progress.pass = 0;
+        progress.aov_pass = false;
+        progress.aov_done = 0;
+        progress.aov_total = tile_count;
+        progress.finished = false;
+        if (progressive)
+            progress.total = tile_count * samples_per_pixel;
+        else if (adaptive_threshold > 0)
+            progress.total = (long long)samples_per_pixel * image_width * (image_height - 10);
+        else
+            progress.total = tile_count;
+
+        draw_gradient_strip();
+        std::thread render_thread([&]
+                                  {
+                                      if (progressive)
+                                          render_progressive(world, use_openmp);
+                                      else if (adaptive_threshold > 0)
+                                          render_adaptive(world, use_openmp);
+                                      else
+                                          tiles.run([&](const Tile &tile)
+                                                    {
+                                                        render_tile(tile, world, use_sample_rate);
+                                                        progress.done++;
+                                                    },
+                                                    use_openmp);
+                                      if (aovs)
+                                      {
+                                          progress.aov_pass = true;
+                                          render_aovs(world, use_openmp);
+                                      }
+                                      progress.finish();
+                                  });
+        present(display);
+        render_thread.join();
+
+        develop(use_openmp);
+        if (display)
+            screen.display(1);
+        std::clog << "\rDone.                                  \n";
+    }
 
-        std::clog << "\rDone.                 \n";
+    // Filter the developed image with the AOV-guided denoiser and tone map it again
+    void denoise(bool use_openmp)
+    {
+        if (!framebuffer.has_aovs())
+        {
+            std::cerr << "Error: Denoising needs the AOVs of the render." << std::endl;
+            return;
+        }
+        Denoiser().run(framebuffer, film, 10, image_height, use_openmp);
+        screen.tonemap(framebuffer.color.data(), 10, image_height, std::exp2(exposure), reinhard, use_openmp);
     }
 
     void initialize()
@@ -101,19 +176,408 @@ public:
         // Create screen buffer
         screen = Screen(image_width, image_height, screen_scale, screen_name);
         screen.clear();
+        film = Film(image_width, image_height);
+        framebuffer = FrameBuffer(image_width, image_height, aovs);
+        tiles = TileScheduler(image_width, 10, image_height, tile_size);
+    }
+
+    // Mean samples per pixel in the film, without the gradient strip
+    double average_samples() const
+    {
+        long long total = 0;
+        for (int j = 10; j < image_height; j++)
+            for (int i = 0; i < image_width; i++)
+                total += film.sample_count(i, j);
+        return double(total) / (double(image_width) * (image_height - 10));
+    }
+
+    // Image of the samples each pixel took, blue (few) to red (most)
+    // The gradient strip at the top doubles as the legend.
+    void save_sample_heatmap(const std::string &filepath) const
+    {
+        int max_count = 1;
+        for (int j = 10; j < image_height; j++)
+            for (int i = 0; i < image_width; i++)
+                max_count = std::max(max_count, film.sample_count(i, j));
+
+        Screen heatmap(image_width, image_height, 1.0, "samples");
+        for (int j = 0; j < image_height; j++)
+            for (int i = 0; i < image_width; i++)
+                heatmap.set_color(i, j, j < 10 ? convert_int_to_color(i, image_width)
+                                               : convert_int_to_color(film.sample_count(i, j), max_count));
+        heatmap.save(filepath);
     }
 
 private:
+    // Adaptive sampling gives no pixel more than this many times samples_per_pixel
+    static constexpr int ADAPTIVE_MAX_FACTOR = 8;
+
+    // Primary rays per pixel for the AOVs
+    static constexpr int AOV_SAMPLES = 8;
+
     vec3 center;        // Camera center
     vec3 pixel00_loc;   // Location of pixel 0, 0
     vec3 pixel_delta_u; // Offset to pixel to the right
     vec3 pixel_delta_v; // Offset to pixel below
     vec3 u, v, w;       // Camera frame basis vectors
 
-    ray get_ray(int i, int j) const
+    uint64_t get_pixel_index(int i, int j) const
+    {
+        return uint64_t(j) * image_width + i;
+    }
+
+    // Refresh the progress line, and the window with `display`, at display_fps
+    // until the render thread finishes
+    void present(bool display)
+    {
+        auto frame = std::chrono::duration<double>(1.0 / std::max(display_fps, 0.1));
+        while (!progress.finished)
+        {
+            {
+                std::unique_lock<std::mutex> lock(progress.lock);
+                progress.wake.wait_for(lock, frame, [&]
+                                       { return progress.finished.load(); });
+            }
+
+            if (progress.aov_pass)
+            {
+                double percent = 100.0 * std::min(1.0, double(progress.aov_done) / std::max(1LL, progress.aov_total));
+                std::clog << "\rAOVs: " << int(percent) << "%              " << std::flush;
+                continue; // The image is final already
+            }
+
+            double percent = 100.0 * std::min(1.0, double(progress.done) / std::max(1LL, progress.total));
+            std::clog << "\rRendering: " << int(percent) << '%';
+            if (progressive)
+                std::clog << ", pass " << progress.pass << '/' << samples_per_pixel;
+            else if (adaptive_threshold > 0)
+                std::clog << ", round " << progress.pass;
+            std::clog << "        " << std::flush;
+
+            if (display)
+            {
+                develop_preview();
+                screen.display(1);
+            }
+        }
+    }
+
+    // Film to the linear float image, then the tone mapping pass into the screen
+    void develop(bool parallel)
+    {
+        framebuffer.resolve(film, 10, image_height, parallel);
+        screen.tonemap(framebuffer.color.data(), 10, image_height, std::exp2(exposure), reinhard, parallel);
+    }
+
+    // develop() while the render thread runs
+    // Workers write the film only inside their tile's lock, so tiles being
+    // rendered are skipped instead of read halfway through an update. Only
+    // this thread touches the framebuffer color until the render ends.
+    void develop_preview()
+    {
+        tiles.read_idle_tiles([&](const Tile &tile)
+                              { framebuffer.resolve(film, tile.x0, tile.y0, tile.x1, tile.y1); });
+        screen.tonemap(framebuffer.color.data(), 10, image_height, std::exp2(exposure), reinhard, false);
+    }
+
+    // First-hit albedo, normal and depth of every pixel, averaged over the
+    // first AOV_SAMPLES samples of its sequence, so they line up with the
+    // color's primary rays and are antialiased the same way
+    void render_aovs(const hittable_list &world, bool use_openmp)
+    {
+        tiles.run([&](const Tile &tile)
+                  {
+                      for (int j = tile.y0; j < tile.y1; j++)
+                      {
+                          for (int i = tile.x0; i < tile.x1; i++)
+                          {
+                              vec3 albedo(0, 0, 0), normal(0, 0, 0);
+                              double depth = 0;
+                              for (int sample = 0; sample < AOV_SAMPLES; sample++)
+                              {
+                                  sampler rng;
+                                  rng.start_pixel_sample(get_pixel_index(i, j), sample, seed);
+                                  ray r = get_ray(i, j, rng);
+                                  hit_record rec;
+                                  if (!world.hit(r, interval(0, infinity), rec))
+                                  {
+                                      albedo += background_color;
+                                      continue;
+                                  }
+                                  rec.resolve(r);
+                                  albedo += (mat ? mat.get() : rec.mat)->albedo(rec);
+                                  normal += rec.normal;
+                                  depth += rec.t;
+                              }
+
+                              size_t index = get_pixel_index(i, j);
+                              for (int c = 0; c < 3; c++)
+                              {
+                                  framebuffer.albedo[3 * index + c] = float(albedo[c] / AOV_SAMPLES);
+                                  framebuffer.normal[3 * index + c] = float(normal[c] / AOV_SAMPLES);
+                              }
+                              framebuffer.depth[index] = float(depth / AOV_SAMPLES);
+                          }
+                      }
+                      progress.aov_done++;
+                  },
+                  use_openmp);
+    }
+
+    // Color gradient strip in the top 10 rows to help analyze BVH tree depth
+    // and see at what depth each pixel was hit
+    void draw_gradient_strip()
+    {
+        for (int j = 0; j < 10; j++)
+            for (int i = 0; i < image_width; i++)
+                screen.set_color(i, j, convert_int_to_color(i, image_width));
+    }
+
+    // `samples_per_pixel` passes of one sample per pixel over the whole image
+    // Every pass continues each pixel's sample sequence, so N passes give the
+    // same image as one N sample render without the dynamic sample rate.
+    void render_progressive(const hittable_list &world, bool use_openmp)
+    {
+        for (int pass = 0; pass < samples_per_pixel; pass++)
+        {
+            progress.pass = pass + 1;
+            tiles.run([&](const Tile &tile)
+                      {
+                          for (int j = tile.y0; j < tile.y1; j++)
+                          {
+                              for (int i = tile.x0; i < tile.x1; i++)
+                              {
+                                  sampler rng;
+                                  rng.start_pixel_sample(get_pixel_index(i, j), film.sample_count(i, j), seed);
+                                  ray r = get_ray(i, j, rng);
+                                  film.add_sample(i, j, ray_color(r, max_depth, world, rng));
+                              }
+                          }
+                          progress.done++;
+                      },
+                      use_openmp);
+        }
+    }
+
+    // Adaptive sampling with a budget of samples_per_pixel samples per pixel
+    // Every pixel first takes a small batch. After that, rounds give another
+    // batch to each pixel whose relative error is still above the threshold,
+    // the noisiest first when the remaining budget cannot cover them all.
+    // Pixels only continue their own sample sequence, so the result does not
+    // depend on the thread count.
+    void render_adaptive(const hittable_list &world, bool use_openmp)
+    {
+        int batch_size = std::max(4, samples_per_pixel / 8);
+        int max_samples = ADAPTIVE_MAX_FACTOR * samples_per_pixel;
+        long long budget = (long long)samples_per_pixel * image_width * (image_height - 10);
+
+        std::vector<int> batch(size_t(image_width) * image_height, 0);
+        for (int j = 10; j < image_height; j++)
+            for (int i = 0; i < image_width; i++)
+                batch[get_pixel_index(i, j)] = std::max(0, batch_size - film.sample_count(i, j));
+
+        for (int round = 1;; round++)
+        {
+            progress.pass = round;
+            std::atomic<long long> taken(0);
+            tiles.run([&](const Tile &tile)
+                      {
+                          long long tile_taken = 0;
+                          for (int j = tile.y0; j < tile.y1; j++)
+                          {
+                              for (int i = tile.x0; i < tile.x1; i++)
+                              {
+                                  int n = batch[get_pixel_index(i, j)];
+                                  if (n == 0)
+                                      continue;
+                                  sample_pixel(i, j, n, world);
+                                  tile_taken += n;
+                              }
+                          }
+                          taken += tile_taken;
+                          progress.done += tile_taken;
+                      },
+                      use_openmp);
+            budget -= taken;
+
+            // Pixels still above the error threshold, noisiest first
+            std::vector<std::pair<double, int>> noisy;
+            for (int j = 10; j < image_height; j++)
+            {
+                for (int i = 0; i < image_width; i++)
+                {
+                    double error = film.relative_error(i, j);
+                    if (error > adaptive_threshold && film.sample_count(i, j) < max_samples)
+                        noisy.push_back({error, int(get_pixel_index(i, j))});
+                }
+            }
+            if (noisy.empty() || budget < batch_size)
+                break;
+
+            size_t n_next = std::min<size_t>(noisy.size(), budget / batch_size);
+            if (n_next < noisy.size())
+                std::nth_element(noisy.begin(), noisy.begin() + n_next, noisy.end(),
+                                 [](const auto &a, const auto &b)
+                                 { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+
+            std::fill(batch.begin(), batch.end(), 0);
+            for (size_t k = 0; k < n_next; k++)
+            {
+                int index = noisy[k].second;
+                batch[index] = std::min(batch_size, max_samples - film.sample_count(index % image_width, index / image_width));
+            }
+        }
+    }
+
+    // All pixels of one tile, at the dynamic sample rate when enabled
+    void render_tile(const Tile &tile, const hittable_list &world, bool use_sample_rate)
+    {
+        if (use_packets)
+        {
+            for (int j = tile.y0; j < tile.y1; j++)
+                render_span_packets(j, tile.x0, tile.x1, world, use_sample_rate);
+            return;
+        }
+
+        for (int j = tile.y0; j < tile.y1; j++)
+        {
+            for (int i = tile.x0; i < tile.x1; i++)
+            {
+                int current_samples_per_pixel = samples_per_pixel;
+
+                if (use_sample_rate)
+                {
+                    // Probe the first hit to determine the sample rate, on a stream of its
+                    // own so the count does not depend on a sample that is also averaged
+                    sampler rng;
+                    hit_record rec;
+                    rng.start_pixel_probe(get_pixel_index(i, j), seed);
+                    ray r = get_ray(i, j, rng);
+                    bool hit_anything = world.hit(r, interval(0, infinity), rec);
+                    if (hit_anything)
+                        rec.resolve(r);
+                    current_samples_per_pixel = hit_anything ? rec.mat->apply_sample_rate(samples_per_pixel) : samples_per_pixel;
+                }
+
+                sample_pixel(i, j, current_samples_per_pixel, world);
+            }
+        }
+    }
+
+    // Take `n` more samples of pixel (i, j) into the film
+    void sample_pixel(int i, int j, int n, const hittable_list &world)
+    {
+        sampler rng;
+        uint64_t pixel_index = get_pixel_index(i, j);
+        int first_sample = film.sample_count(i, j);
+        vec3 pixel_color(0, 0, 0);
+        double luminance_sq = 0;
+        for (int sample = 0; sample < n; sample++)
+        {
+            rng.start_pixel_sample(pixel_index, first_sample + sample, seed);
+            ray r = get_ray(i, j, rng);
+            vec3 sample_color = ray_color(r, max_depth, world, rng);
+            pixel_color += sample_color;
+            luminance_sq += Film::luminance(sample_color) * Film::luminance(sample_color);
+        }
+        film.add(i, j, pixel_color, n, luminance_sq);
+    }
+
+    // Packet version of the pixel loop for pixels [x0, x1) of one scanline
+    // Each lane keeps the sampler of its own pixel, so the result matches the scalar path
+    void render_span_packets(int j, int x0, int x1, const hittable_list &world, bool use_sample_rate)
+    {
+        constexpr int W = ray_packet::WIDTH;
+
+        for (int i0 = x0; i0 < x1; i0 += W)
+        {
+            sampler rng[W];
+            ray rays[W];
+            vec3 pixel_color[W];
+            double luminance_sq[W] = {};
+            int lane_samples[W];
+            int first_sample[W];
+            int lanes = 0; // Lanes inside the span
+
+            for (int k = 0; k < W; k++)
+            {
+                lane_samples[k] = 0;
+                first_sample[k] = 0;
+                if (i0 + k < x1)
+                {
+                    lanes |= 1 << k;
+                    lane_samples[k] = samples_per_pixel;
+                    first_sample[k] = film.sample_count(i0 + k, j);
+                }
+            }
+
+            if (use_sample_rate)
+            {
+                // Probe the first hits to determine the sample rates (see render_tile)
+                hit_record recs[W];
+                for (int k = 0; k < W; k++)
+                {
+                    if (!(lanes >> k & 1))
+                        continue;
+                    rng[k].start_pixel_probe(get_pixel_index(i0 + k, j), seed);
+                    rays[k] = get_ray(i0 + k, j, rng[k]);
+                }
+                ray_packet packet(rays, interval(0, infinity));
+                int hits = world.hit(packet, lanes, recs);
+                for (int k = 0; k < W; k++)
+                {
+                    if (!(lanes >> k & 1))
+                        continue;
+                    lane_samples[k] = samples_per_pixel;
+                    if (hits >> k & 1)
+                    {
+                        recs[k].resolve(rays[k]);
+                        lane_samples[k] = recs[k].mat->apply_sample_rate(samples_per_pixel);
+                    }
+                }
+            }
+
+            int max_samples = *std::max_element(lane_samples, lane_samples + W);
+            for (int sample = 0; sample < max_samples; sample++)
+            {
+                int active = 0;
+                for (int k = 0; k < W; k++)
+                {
+                    if (sample >= lane_samples[k])
+                        continue;
+                    active |= 1 << k;
+                    rng[k].start_pixel_sample(get_pixel_index(i0 + k, j), first_sample[k] + sample, seed);
+                    rays[k] = get_ray(i0 + k, j, rng[k]);
+                }
+
+                hit_record recs[W];
+                ray_packet packet(rays, interval(0, infinity));
+                int hits = world.hit(packet, active, recs);
+
+                // Secondary rays are incoherent, continue each lane on its own
+                for (int k = 0; k < W; k++)
+                {
+                    if (!(active >> k & 1) || max_depth <= 0)
+                        continue;
+                    vec3 sample_color = shade(rays[k], hits >> k & 1, recs[k], max_depth, world, rng[k]);
+                    pixel_color[k] += sample_color;
+                    luminance_sq[k] += Film::luminance(sample_color) * Film::luminance(sample_color);
+                }
+            }
+
+            for (int k = 0; k < W; k++)
+            {
+                if (!(lanes >> k & 1))
+                    continue;
+                film.add(i0 + k, j, pixel_color[k], lane_samples[k], luminance_sq[k]);
+            }
+        }
+    }
+
+    ray get_ray(int i, int j, sampler &rng) const
     {
         // Construct a camera ray directed at a randomly sampled point around pixel (i,j)
-        auto offset = sample_square();
+        auto offset = sample_square(rng);
         auto pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_u) + ((j + offset.y()) * pixel_delta_v);
 
         auto ray_origin = center;
@@ -122,41 +586,131 @@ private:
         return ray(ray_origin, ray_direction);
     }
 
-    vec3 sample_square() const
+    vec3 sample_square(sampler &rng) const
     {
         // Returns a random point in the [-0.5,-0.5] to [0.5,0.5] unit square
-        return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+        return vec3(random_double(rng) - 0.5, random_double(rng) - 0.5, 0);
     }
 
-    vec3 ray_color(const ray &r, int depth, const hittable_list &world) const
+    vec3 ray_color(const ray &r, int depth, const hittable_list &world, sampler &rng) const
     {
         // If we've exceeded the ray bounce limit, no more light is gathered
         if (depth <= 0)
             return vec3(0, 0, 0);
 
         hit_record rec;
-        bool hit_anything = world.hit(r, interval(0.001, infinity), rec);
+        bool hit_anything = world.hit(r, interval(0, infinity), rec);
 
-        if (!hit_anything)
-            return background_color;
+        return shade(r, hit_anything, rec, depth, world, rng);
+    }
 
-        auto m = mat;
-        if (mat == nullptr)
-            m = rec.mat;
+    // Color carried back along a path whose first hit (if any) is already known
+    // The path is followed in a loop with a running throughput instead of
+    // recursion. Each hit is resolved once, after traversal has settled on it.
+    // After `russian_roulette` bounces a path survives with probability equal
+    // to its largest throughput component, and survivors are weighted up by
+    // the same factor, so the estimate stays unbiased.
+    // With `next_event`, diffuse hits also sample a light directly. A light
+    // then reached by the scattered ray is weighted against that sample with
+    // the power heuristic, so neither strategy counts it twice.
+    vec3 shade(const ray &r_in, bool hit_anything, hit_record &rec, int depth, const hittable_list &world, sampler &rng) const
+    {
+        ray r = r_in;
+        vec3 throughput(1, 1, 1);
+        vec3 color(0, 0, 0);
+        bool sample_lights = next_event && !mat && !lights.empty();
 
-        vec3 emit_color;
-        bool can_emit = m->emit(r, rec, emit_color);
-        if (can_emit)
-            return emit_color;
+        // Previous diffuse vertex and the density its scattered ray was drawn with
+        bool after_diffuse = false;
+        vec3 diffuse_point;
+        double bsdf_pdf = 0;
 
-        ray scattered;
-        vec3 attenuation;
-        bool can_scatter = m->scatter(r, rec, attenuation, scattered);
+        for (int bounce = 1;; bounce++)
+        {
+            if (!hit_anything)
+                return color + throughput * background_color;
+
+            rec.resolve(r);
+            const material *m = mat ? mat.get() : rec.mat;
 
-        if (can_scatter)
-            return attenuation * ray_color(scattered, depth - 1, world);
+            vec3 emit_color;
+            if (m->emit(r, rec, emit_color))
+            {
+                double weight = 1;
+                if (after_diffuse)
+                {
+                    double light_pdf = lights.pdf(diffuse_point, rec.object);
+                    weight = power_heuristic(bsdf_pdf, light_pdf);
+                }
+                return color + throughput * emit_color * weight;
+            }
 
-        return vec3(0, 0, 0);
+            vec3 albedo;
+            bool diffuse = sample_lights && bounce < depth && m->diffuse_albedo(rec, albedo);
+            if (diffuse)
+                color = color + throughput * sample_light(rec, albedo, world, rng);
+
+            ray scattered;
+            vec3 attenuation;
+            if (!m->scatter(r, rec, attenuation, scattered, rng))
+                return color;
+
+            // If we've exceeded the ray bounce limit, no more light is gathered
+            if (bounce >= depth)
+                return color;
+            throughput = throughput * attenuation;
+
+            after_diffuse = diffuse;
+            if (diffuse)
+            {
+                diffuse_point = rec.p;
+                bsdf_pdf = std::max(0.0, double(rec.normal.dot(scattered.direction().normalized()))) / pi;
+            }
+
+            if (russian_roulette > 0 && bounce >= russian_roulette)
+            {
+                double survive = std::min(1.0, double(std::max({throughput.x(), throughput.y(), throughput.z()})));
+                if (random_double(rng) >= survive)
+                    return color;
+                throughput = throughput / survive;
+            }
+
+            r = scattered;
+            hit_anything = world.hit(r, interval(0, infinity), rec);
+        }
+    }
+
+    // Light arriving directly from one sampled light at a diffuse hit, MIS weighted
+    vec3 sample_light(const hit_record &rec, const vec3 &albedo, const hittable_list &world, sampler &rng) const
+    {
+        vec3 direction;
+        double light_pdf;
+        const sphere *light = lights.sample(rec.p, rng, direction, light_pdf);
+        double cosine = rec.normal.dot(direction);
+        if (light_pdf <= 0 || cosine <= 0)
+            return vec3(0, 0, 0);
+
+        // The light is visible when nothing blocks the segment up to it
+        ray shadow = rec.spawn_ray(direction);
+        hit_record light_rec;
+        if (!light->hit(shadow, interval(0, infinity), light_rec) ||
+            world.occluded(shadow, interval(0, light_rec.t * (1 - 1e-6))))
+            return vec3(0, 0, 0);
+        light_rec.resolve(shadow);
+
+        vec3 emit_color;
+        if (!light_rec.mat->emit(shadow, light_rec, emit_color))
+            return vec3(0, 0, 0);
+
+        double bsdf_pdf = cosine / pi;
+        double weight = power_heuristic(light_pdf, bsdf_pdf);
+        return albedo * emit_color * (bsdf_pdf * weight / light_pdf);
+    }
+
+    static double power_heuristic(double pdf, double other_pdf)
+    {
+        double a = pdf * pdf, b = other_pdf * other_pdf;
+        return a + b > 0 ? a / (a + b) : 0;
     }
 };
 
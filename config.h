@@ -1,6 +1,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <iomanip>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -11,6 +12,8 @@ struct Config
 {
     int camera_vfov = 20;                   // -v
     int max_depth = 40;                     // -d
+    int russian_roulette = 3;               // -rr
+    bool next_event = true;                 // -ne
     int sample_num = 10;                    // -sa
     int rotate_degree = 0;                  // -rd
     vec3 camera_lookfrom = {1, 1, 1};       // -c0
@@ -25,6 +28,33 @@ struct Config
     bool ci = false;                        // -ci
     bool use_sample_rate = true;            // -sr
     bool bvh_sah = true;
+    int bvh_lbvh = 0;                       // -lb
+    double bvh_rebuild_ratio = 1.5;         // -rb
+    int instances = 0;                      // -tl
+    bool indexed_mesh = false;              // -im
+    std::string compare_image = "";         // -cmp
+    std::string output_file = "output.png"; // -o
+    std::string hdr_file = "";              // -hdr
+    bool aovs = false;                      // -aov
+    bool denoise = false;                   // -dn
+    double exposure = 0;                    // -ev
+    bool reinhard = false;                  // -tm
+    int seed = 42;                          // -seed
+    int bench_rays = 0;                     // -bench
+    bool use_packets = false;               // -pk
+    bool progressive = false;               // -pg
+    std::string film_file = "";             // -acc
+    double adaptive_threshold = 0;          // -as
+    std::string heatmap_file = "";          // -hm
+    int tile_size = 32;                     // -ts
+#ifdef HEADLESS
+    bool display = false;                   // -dp, no window in headless builds
+#else
+    bool display = true;                    // -dp
+#endif
+    double display_fps = 10;                // -fps
+    bool bvh_wide = false;                  // -wb
+    bool bvh_stats = false;                 // -st
     bool help = false;
 };
 
@@ -37,6 +67,8 @@ void print_help()
               << "  " << std::setw(16) << "-h" << "Show this help message\n"
               << "  " << std::setw(16) << "-v N" << "Set cam vfov\n"
               << "  " << std::setw(16) << "-d N" << "Set depth\n"
+              << "  " << std::setw(16) << "-rr N" << "Russian roulette after N bounces (0 disables)\n"
+              << "  " << std::setw(16) << "-ne 0" << "Disable direct light sampling (next-event estimation)\n"
               << "  " << std::setw(16) << "-sa N" << "Set sample number\n"
               << "  " << std::setw(16) << "-rd N" << "Set rotate degree\n"
               << "  " << std::setw(16) << "-c0 x y z" << "Set camera look from\n"
@@ -45,9 +77,32 @@ void print_help()
               << "  " << std::setw(16) << "-bvd N" << "Enable BVH depth visualization and set depth\n"
               << "  " << std::setw(16) << "-bvg <str> N" << "Enable BVH group visualization and set root and depth\n"
               << "  " << std::setw(16) << "-sah 0" << "Disable BVH SAH algorithm\n"
+              << "  " << std::setw(16) << "-lb N" << "Build an LBVH (1) or LBVH with SAH upper tree (2)\n"
+              << "  " << std::setw(16) << "-rb X" << "Rebuild instead of refit when BVH cost grows X times (-ci -rd)\n"
+              << "  " << std::setw(16) << "-tl N" << "Two-level BVH with N instances of the mesh (startup only)\n"
+              << "  " << std::setw(16) << "-im 1" << "Load the mesh as an indexed mesh (startup only)\n"
+              << "  " << std::setw(16) << "-cmp <file>" << "Compare the output with a reference image\n"
+              << "  " << std::setw(16) << "-o <file>" << "Write the image to file (.png and .ppm built in, other formats through OpenCV)\n"
+              << "  " << std::setw(16) << "-hdr <file>" << "Also write the linear image as float PFM\n"
+              << "  " << std::setw(16) << "-aov 1" << "Capture albedo, normal and depth AOVs, saved next to -hdr\n"
+              << "  " << std::setw(16) << "-dn 1" << "Denoise guided by the AOVs (implies -aov 1, leaves -sr on)\n"
+              << "  " << std::setw(16) << "-ev X" << "Tone mapping exposure in stops\n"
+              << "  " << std::setw(16) << "-tm 1" << "Reinhard tone mapping instead of clipping\n"
               << "  " << std::setw(16) << "-mp 0" << "Disable OpenMP\n"
               << "  " << std::setw(16) << "-ci" << "Enable continuous input\n"
-              << "  " << std::setw(16) << "-sr 0" << "Disable dynamic sample rate\n";
+              << "  " << std::setw(16) << "-sr 0" << "Disable dynamic sample rate\n"
+              << "  " << std::setw(16) << "-seed N" << "Set random seed\n"
+              << "  " << std::setw(16) << "-bench N" << "Benchmark BVH node tests with N rays\n"
+              << "  " << std::setw(16) << "-pk 1" << "Trace primary rays as 4-wide SIMD packets\n"
+              << "  " << std::setw(16) << "-pg 1" << "Progressive rendering, one sample per pixel per pass\n"
+              << "  " << std::setw(16) << "-acc <file>" << "Continue the accumulation in file and save it after rendering\n"
+              << "  " << std::setw(16) << "-as X" << "Adaptive sampling down to relative error X, -sa is the average budget\n"
+              << "  " << std::setw(16) << "-hm <file>" << "Save a heatmap of the samples per pixel\n"
+              << "  " << std::setw(16) << "-ts N" << "Render in N x N pixel tiles\n"
+              << "  " << std::setw(16) << "-dp 0" << "Disable the image window (headless batch runs)\n"
+              << "  " << std::setw(16) << "-fps X" << "Refresh the window and progress X times per second\n"
+              << "  " << std::setw(16) << "-wb 1" << "Collapse the BVH into a 4-wide BVH\n"
+              << "  " << std::setw(16) << "-st 1" << "Report BVH traversal and tile timing statistics\n";
 }
 
 void show_config(Config config)
@@ -55,8 +110,12 @@ void show_config(Config config)
     // Display current configuration
     std::cout << "Current configuration:\n"
               << "    Depth: " << config.max_depth << "\n"
+              << "        Russian roulette: " << (config.russian_roulette > 0 ? "ON " : "OFF ") << config.russian_roulette << "\n"
+              << "        Next-event estimation: " << (config.next_event ? "ON " : "OFF ") << "\n"
               << "    Samples: " << config.sample_num << "\n"
               << "        Dynamic sample rate: " << (config.use_sample_rate ? "ON " : "OFF ") << "\n"
+              << "        Adaptive sampling: " << (config.adaptive_threshold > 0 ? "ON " : "OFF ") << config.adaptive_threshold << "\n"
+              << "        Seed: " << config.seed << "\n"
               << "    Rotation: " << config.rotate_degree << " degrees\n"
               << "    Camera: " << "\n"
               << "        Look from: " << config.camera_lookfrom << "\n"
@@ -64,7 +123,18 @@ void show_config(Config config)
               << "        vFov: " << config.camera_vfov << "\n"
               << "    Preset: " << config.preset_id << "\n"
               << "    OpenMP: " << (config.use_openmp ? "ON " : "OFF ") << "\n"
-              << "    BVH: " << (config.bvh_sah ? "SAH " : "MIDDLE ") << "\n"
+              << "    Output: " << config.output_file << "\n"
+              << "        HDR: " << (config.hdr_file.empty() ? "OFF" : config.hdr_file) << (config.aovs ? " + AOVs" : "") << "\n"
+              << "        Denoise: " << (config.denoise ? "ON " : "OFF ") << "\n"
+              << "        Tone mapping: " << (config.reinhard ? "Reinhard " : "Clip ") << config.exposure << " EV\n"
+              << "    Tile size: " << config.tile_size << "\n"
+              << "    Display: " << (config.display ? "ON " : "OFF ") << config.display_fps << " fps\n"
+              << "    Ray packets: " << (config.use_packets ? "ON " : "OFF ") << "\n"
+              << "    Progressive: " << (config.progressive ? "ON " : "OFF ") << "\n"
+              << "    Accumulation file: " << (config.film_file.empty() ? "OFF" : config.film_file) << "\n"
+              << "    BVH: " << (config.bvh_lbvh == 1 ? "LBVH " : config.bvh_lbvh == 2 ? "HLBVH " : config.bvh_sah ? "SAH " : "MIDDLE ") << (config.bvh_wide ? "WIDE " : "") << "\n"
+              << "    Two-level BVH: " << (config.instances > 0 ? "ON " : "OFF ") << config.instances << "\n"
+              << "    Indexed mesh: " << (config.indexed_mesh ? "ON " : "OFF ") << "\n"
               << "    BVH Depth Visual: " << (config.bvh_depth_visual ? "ON " : "OFF ") << config.bvh_depth_visual_h << "\n"
               << "    BVH Group Visual: " << (config.bvh_group_visual ? "ON " : "OFF ") << config.bvh_group_visual_h << " \"" << config.bvh_group_visual_root << "\"\n"
               << "    Continuous input: " << (config.ci ? "ON " : "OFF ") << "\n";
@@ -93,6 +163,76 @@ void parse_args(Config &config, int argc, char *argv[], int start)
             config.use_sample_rate = std::stoi(argv[i + 1]);
             i += 2;
         }
+        else if (arg == "-rr")
+        {
+            config.russian_roulette = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-ne")
+        {
+            config.next_event = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-seed")
+        {
+            config.seed = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-wb")
+        {
+            config.bvh_wide = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-st")
+        {
+            config.bvh_stats = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-ts")
+        {
+            config.tile_size = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-dp")
+        {
+            config.display = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-fps")
+        {
+            config.display_fps = std::stod(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-pk")
+        {
+            config.use_packets = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-pg")
+        {
+            config.progressive = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-acc")
+        {
+            config.film_file = argv[i + 1];
+            i += 2;
+        }
+        else if (arg == "-as")
+        {
+            config.adaptive_threshold = std::stod(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-hm")
+        {
+            config.heatmap_file = argv[i + 1];
+            i += 2;
+        }
+        else if (arg == "-bench")
+        {
+            config.bench_rays = std::stoi(argv[i + 1]);
+            i += 2;
+        }
 
         else if (arg == "-ci")
         {
@@ -211,6 +351,61 @@ void parse_args(Config &config, int argc, char *argv[], int start)
             config.bvh_sah = std::stoi(argv[i + 1]);
             i += 2;
         }
+        else if (arg == "-lb")
+        {
+            config.bvh_lbvh = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-tl")
+        {
+            config.instances = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-im")
+        {
+            config.indexed_mesh = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-cmp")
+        {
+            config.compare_image = argv[i + 1];
+            i += 2;
+        }
+        else if (arg == "-o")
+        {
+            config.output_file = argv[i + 1];
+            i += 2;
+        }
+        else if (arg == "-hdr")
+        {
+            config.hdr_file = argv[i + 1];
+            i += 2;
+        }
+        else if (arg == "-aov")
+        {
+            config.aovs = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-dn")
+        {
+            config.denoise = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-ev")
+        {
+            config.exposure = std::stod(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-tm")
+        {
+            config.reinhard = std::stoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "-rb")
+        {
+            config.bvh_rebuild_ratio = std::stod(argv[i + 1]);
+            i += 2;
+        }
         else
         {
             std::cout << "E: Unexpected Input: " << arg << std::endl;
@@ -0,0 +1,277 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "film.h"
+#include "framebuffer.h"
+
+// Edge-avoiding a-trous wavelet filter guided by the first-hit AOVs
+// (Dammertz et al. 2010). Every iteration applies a 5x5 B3-spline kernel
+// whose taps are twice as far apart as in the previous one. Taps are weighted
+// down across normal, albedo and depth edges, and across luminance steps
+// larger than the pixel's own noise, estimated from the film's per-pixel
+// variance as in SVGF. The color is divided by the albedo before filtering
+// and multiplied back afterwards, so textures stay sharp and only the
+// lighting is smoothed.
+class Denoiser
+{
+public:
+    int iterations = 5;
+    float sigma_luminance = 4;  // Luminance edge stop, in standard deviations of the noise
+    float sigma_albedo = 0.1f;  // Albedo edge stop
+    float sigma_depth = 0.02f;  // Relative depth edge stop per pixel of tap distance
+
+    // Filter rows [y_begin, y_end) of fb.color in place, fb must have AOVs
+    void run(FrameBuffer &fb, const Film &film, int y_begin, int y_end, bool parallel) const
+    {
+        int width = fb.get_width();
+        int height = y_end - y_begin;
+        if (!fb.has_aovs() || width <= 0 || height <= 0)
+            return;
+
+        // Planes of the filtered rows, one float per pixel each
+        size_t n = size_t(width) * height;
+        Planes in(n), out(n);
+        std::vector<float> ar(n), ag(n), ab(n), nx(n), ny(n), nz(n), z(n);
+
+#pragma omp parallel for if (parallel)
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                size_t p = size_t(y) * width + x;
+                size_t src = size_t(y + y_begin) * width + x;
+                ar[p] = fb.albedo[3 * src + 0] + ALBEDO_EPSILON;
+                ag[p] = fb.albedo[3 * src + 1] + ALBEDO_EPSILON;
+                ab[p] = fb.albedo[3 * src + 2] + ALBEDO_EPSILON;
+                nx[p] = fb.normal[3 * src + 0];
+                ny[p] = fb.normal[3 * src + 1];
+                nz[p] = fb.normal[3 * src + 2];
+                z[p] = fb.depth[src];
+
+                in.r[p] = fb.color[3 * src + 0] / ar[p];
+                in.g[p] = fb.color[3 * src + 1] / ag[p];
+                in.b[p] = fb.color[3 * src + 2] / ab[p];
+                double albedo_luminance = Film::luminance(vec3(ar[p], ag[p], ab[p]));
+                double variance = film.mean_variance(x, y + y_begin);
+                in.var[p] = std::isfinite(variance) ? float(variance / (albedo_luminance * albedo_luminance)) : -1.0f;
+            }
+        }
+
+        // Pixels with a single sample (e.g. diffuse ones under the dynamic
+        // sample rate) have no variance of their own, it is estimated from
+        // the spread of their neighbours' luminance as in SVGF
+#pragma omp parallel for if (parallel)
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                size_t p = size_t(y) * width + x;
+                if (in.var[p] < 0)
+                    in.var[p] = spatial_variance(in, nx.data(), ny.data(), nz.data(), z.data(), width, height, x, y);
+            }
+        }
+
+        static constexpr float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+        Guides guides = {ar.data(), ag.data(), ab.data(), nx.data(), ny.data(), nz.data(), z.data(),
+                         1 / (sigma_albedo * sigma_albedo)};
+
+        for (int iteration = 0; iteration < iterations; iteration++)
+        {
+            int step = 1 << iteration;
+
+#pragma omp parallel for if (parallel)
+            for (int y = 0; y < height; y++)
+            {
+                std::vector<float> sums(6 * size_t(width), 0.0f);
+                float *sum_r = sums.data(), *sum_g = sum_r + width, *sum_b = sum_g + width;
+                float *sum_w = sum_b + width, *sum_var = sum_w + width, *luminance_scale = sum_var + width;
+                const size_t row = size_t(y) * width;
+
+                for (int x = 0; x < width; x++)
+                {
+                    size_t p = row + x;
+                    luminance_scale[x] = 1 / (sigma_luminance * std::sqrt(std::max(in.var[p], 0.0f)) + 1e-4f);
+                }
+
+                for (int dy = -2; dy <= 2; dy++)
+                {
+                    int yq = y + dy * step;
+                    if (yq < 0 || yq >= height)
+                        continue;
+                    const size_t row_q = size_t(yq) * width;
+
+                    for (int dx = -2; dx <= 2; dx++)
+                    {
+                        int offset = dx * step;
+                        int x_begin = std::max(0, -offset);
+                        int x_end = std::min(width, width - offset);
+                        float h = kernel[dy + 2] * kernel[dx + 2];
+                        float inv_depth_sigma = 1 / (sigma_depth * step * std::max(std::abs(dx), std::abs(dy)) + 1e-6f);
+
+                        accumulate_taps(in, guides, row, row_q + offset, x_begin, x_end, h, inv_depth_sigma,
+                                        luminance_scale, sum_r, sum_g, sum_b, sum_w, sum_var);
+                    }
+                }
+
+                for (int x = 0; x < width; x++)
+                {
+                    size_t p = row + x;
+                    // The center tap always has weight, unless a miss sits among hits
+                    if (sum_w[x] <= 0)
+                    {
+                        out.r[p] = in.r[p];
+                        out.g[p] = in.g[p];
+                        out.b[p] = in.b[p];
+                        out.var[p] = in.var[p];
+                        continue;
+                    }
+                    out.r[p] = sum_r[x] / sum_w[x];
+                    out.g[p] = sum_g[x] / sum_w[x];
+                    out.b[p] = sum_b[x] / sum_w[x];
+                    out.var[p] = sum_var[x] / (sum_w[x] * sum_w[x]);
+                }
+            }
+
+            std::swap(in, out);
+        }
+
+#pragma omp parallel for if (parallel)
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                size_t p = size_t(y) * width + x;
+                size_t dst = size_t(y + y_begin) * width + x;
+                fb.color[3 * dst + 0] = in.r[p] * ar[p];
+                fb.color[3 * dst + 1] = in.g[p] * ag[p];
+                fb.color[3 * dst + 2] = in.b[p] * ab[p];
+            }
+        }
+    }
+
+private:
+    // Keeps black surfaces from dividing by zero
+    static constexpr float ALBEDO_EPSILON = 0.01f;
+    // Stands in for a variance that cannot be estimated; finite, so zero
+    // weights times the variance stay zero
+    static constexpr float UNKNOWN_VARIANCE = 1e30f;
+
+    // Illumination and the variance of its luminance
+    struct Planes
+    {
+        std::vector<float> r, g, b, var;
+        Planes(size_t n) : r(n), g(n), b(n), var(n) {}
+    };
+
+    // Feature planes that stop the filter at edges
+    struct Guides
+    {
+        const float *albedo_r, *albedo_g, *albedo_b;
+        const float *normal_x, *normal_y, *normal_z;
+        const float *depth;
+        float inv_sigma_albedo_sq;
+    };
+
+    // Variance of the luminance over the pixels of a 5x5 window on the same
+    // surface as (x, y): all hits with similar normals, or all misses.
+    // With fewer than two such pixels the variance is unknown and taken as
+    // huge, which turns the luminance edge stop off for the pixel.
+    static float spatial_variance(const Planes &in, const float *nx, const float *ny, const float *nz,
+                                  const float *depth, int width, int height, int x, int y)
+    {
+        const int RADIUS = 2;
+        size_t p = size_t(y) * width + x;
+        bool hit_p = depth[p] > 0;
+        double sum = 0, sum_sq = 0;
+        int count = 0;
+        for (int yq = std::max(0, y - RADIUS); yq <= std::min(height - 1, y + RADIUS); yq++)
+        {
+            for (int xq = std::max(0, x - RADIUS); xq <= std::min(width - 1, x + RADIUS); xq++)
+            {
+                size_t q = size_t(yq) * width + xq;
+                if ((depth[q] > 0) != hit_p)
+                    continue;
+                if (hit_p && nx[p] * nx[q] + ny[p] * ny[q] + nz[p] * nz[q] < 0.9f)
+                    continue;
+                double l = 0.2126 * in.r[q] + 0.7152 * in.g[q] + 0.0722 * in.b[q];
+                sum += l;
+                sum_sq += l * l;
+                count++;
+            }
+        }
+        if (count < 2)
+            return UNKNOWN_VARIANCE;
+        double mean = sum / count;
+        return float(std::max(0.0, (sum_sq - count * mean * mean) / (count - 1)));
+    }
+
+    // Weighted taps q = p + offset for pixels p in [row + x_begin, row + x_end),
+    // added to the row sums. The loop runs over contiguous memory with every
+    // plane read at a constant offset, so it vectorizes.
+    static void accumulate_taps(const Planes &in, const Guides &guides, size_t row, size_t row_q, int x_begin, int x_end,
+                                float h, float inv_depth_sigma, const float *__restrict luminance_scale,
+                                float *__restrict sum_r, float *__restrict sum_g, float *__restrict sum_b,
+                                float *__restrict sum_w, float *__restrict sum_var)
+    {
+        const float *r = in.r.data(), *g = in.g.data(), *b = in.b.data(), *var = in.var.data();
+        const float *albedo_r = guides.albedo_r, *albedo_g = guides.albedo_g, *albedo_b = guides.albedo_b;
+        const float *normal_x = guides.normal_x, *normal_y = guides.normal_y, *normal_z = guides.normal_z;
+        const float *depth = guides.depth;
+        float inv_sigma_albedo_sq = guides.inv_sigma_albedo_sq;
+
+#pragma omp simd
+        for (int x = x_begin; x < x_end; x++)
+        {
+            size_t p = row + x;
+            size_t q = row_q + x;
+
+            float lp = 0.2126f * r[p] + 0.7152f * g[p] + 0.0722f * b[p];
+            float lq = 0.2126f * r[q] + 0.7152f * g[q] + 0.0722f * b[q];
+            float d_luminance = std::abs(lp - lq) * luminance_scale[x];
+
+            float da_r = albedo_r[p] - albedo_r[q];
+            float da_g = albedo_g[p] - albedo_g[q];
+            float da_b = albedo_b[p] - albedo_b[q];
+            float d_albedo = (da_r * da_r + da_g * da_g + da_b * da_b) * inv_sigma_albedo_sq;
+
+            float d_depth = std::abs(depth[p] - depth[q]) * inv_depth_sigma / (depth[p] + 1e-6f);
+
+            // cos^128 by seven squarings, a hit and a miss never mix
+            float c = std::max(0.0f, normal_x[p] * normal_x[q] + normal_y[p] * normal_y[q] + normal_z[p] * normal_z[q]);
+            for (int k = 0; k < 7; k++)
+                c *= c;
+            bool hit_p = depth[p] > 0, hit_q = depth[q] > 0;
+            float w_normal = hit_p == hit_q ? (hit_p ? c : 1.0f) : 0.0f;
+
+            float w = h * w_normal * fast_exp(-(d_luminance + d_albedo + d_depth));
+            sum_r[x] += w * r[q];
+            sum_g[x] += w * g[q];
+            sum_b[x] += w * b[q];
+            sum_w[x] += w;
+            sum_var[x] += w * w * var[q];
+        }
+    }
+
+    // e^x for x <= 0, about 4e-6 relative error
+    // Plain arithmetic and a bit cast, so the filter loop stays vectorized.
+    // Rounding by adding 1.5 * 2^23 instead of std::floor, which gcc only
+    // vectorizes with -fno-trapping-math.
+    static float fast_exp(float x)
+    {
+        x = x > -80.0f ? x : -80.0f;
+        float t = x * 1.44269504f;
+        float i = (t + 12582912.0f) - 12582912.0f;
+        float f = (t - i) * 0.693147181f;
+        float p = 1 + f * (1 + f * (0.5f + f * (1.0f / 6 + f * (1.0f / 24 + f * (1.0f / 120 + f * (1.0f / 720))))));
+        int32_t bits = (int32_t(i) + 127) << 23;
+        float scale;
+        std::memcpy(&scale, &bits, sizeof(scale));
+        return p * scale;
+    }
+};
+
+#endif
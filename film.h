@@ -0,0 +1,165 @@
+#ifndef FILM_H
+#define FILM_H
+
+#include <cstring>
+#include <fstream>
+#include "vec3.h"
+
+// Linear accumulation buffer
+// Each pixel keeps the sum of its samples in double precision and how many
+// samples were taken, so a render can be refined by more passes or saved and
+// continued later. Screen only ever shows the current mean. The sum of squared
+// sample luminances gives the variance used by adaptive sampling.
+class Film
+{
+public:
+    Film() {}
+    Film(int width, int height) : width(width), height(height), sums(size_t(width) * height * 3, 0.0),
+                                  luminance_sq_sums(size_t(width) * height, 0.0), counts(size_t(width) * height, 0) {}
+
+    // Hash of the camera, scene rotation and seed the samples were taken
+    // with, saved with the film so load() only continues the same view
+    uint64_t view_key = 0;
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+
+    void clear()
+    {
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(luminance_sq_sums.begin(), luminance_sq_sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+    }
+
+    static double luminance(const vec3 &color)
+    {
+        return 0.2126 * color.x() + 0.7152 * color.y() + 0.0722 * color.z();
+    }
+
+    // Add `n` samples whose colors sum to `color_sum` and whose squared
+    // luminances sum to `luminance_sq_sum`
+    void add(int x, int y, const vec3 &color_sum, int n, double luminance_sq_sum)
+    {
+        size_t index = size_t(y) * width + x;
+        for (int c = 0; c < 3; c++)
+            sums[3 * index + c] += color_sum[c];
+        luminance_sq_sums[index] += luminance_sq_sum;
+        counts[index] += n;
+    }
+
+    void add_sample(int x, int y, const vec3 &color)
+    {
+        double l = luminance(color);
+        add(x, y, color, 1, l * l);
+    }
+
+    int sample_count(int x, int y) const
+    {
+        return counts[size_t(y) * width + x];
+    }
+
+    // Mean of the samples taken so far
+    vec3 color(int x, int y) const
+    {
+        size_t index = size_t(y) * width + x;
+        if (counts[index] == 0)
+            return vec3(0, 0, 0);
+        return vec3(sums[3 * index], sums[3 * index + 1], sums[3 * index + 2]) / counts[index];
+    }
+
+    // Variance of the mean luminance, infinity below two samples
+    double mean_variance(int x, int y) const
+    {
+        size_t index = size_t(y) * width + x;
+        int n = counts[index];
+        if (n < 2)
+            return infinity;
+        double mean = luminance(vec3(sums[3 * index], sums[3 * index + 1], sums[3 * index + 2])) / n;
+        double variance = std::max(0.0, (luminance_sq_sums[index] - n * mean * mean) / (n - 1));
+        return variance / n;
+    }
+
+    // Standard error of the mean luminance relative to the mean itself
+    // The small floor keeps dark pixels from asking for endless samples.
+    double relative_error(int x, int y) const
+    {
+        double variance = mean_variance(x, y);
+        if (variance == infinity)
+            return infinity;
+        size_t index = size_t(y) * width + x;
+        double mean = luminance(vec3(sums[3 * index], sums[3 * index + 1], sums[3 * index + 2])) / counts[index];
+        return std::sqrt(variance) / (std::fabs(mean) + 0.01);
+    }
+
+    // Binary accumulation file: magic, size, view key, then the sums, squared
+    // luminance sums and counts
+    bool save(const std::string &filepath) const
+    {
+        std::ofstream out(filepath, std::ios::binary);
+        if (!out)
+        {
+            std::cerr << "Error: cannot write accumulation file " << filepath << std::endl;
+            return false;
+        }
+        int32_t size[2] = {width, height};
+        out.write(MAGIC, sizeof(MAGIC));
+        out.write(reinterpret_cast<const char *>(size), sizeof(size));
+        out.write(reinterpret_cast<const char *>(&view_key), sizeof(view_key));
+        out.write(reinterpret_cast<const char *>(sums.data()), sums.size() * sizeof(double));
+        out.write(reinterpret_cast<const char *>(luminance_sq_sums.data()), luminance_sq_sums.size() * sizeof(double));
+        out.write(reinterpret_cast<const char *>(counts.data()), counts.size() * sizeof(int32_t));
+        return bool(out);
+    }
+
+    // Replace the contents with a saved accumulation of the same size and view_key
+    bool load(const std::string &filepath)
+    {
+        std::ifstream in(filepath, std::ios::binary);
+        if (!in)
+            return false;
+
+        char magic[sizeof(MAGIC)];
+        int32_t size[2];
+        uint64_t file_view_key;
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char *>(size), sizeof(size));
+        in.read(reinterpret_cast<char *>(&file_view_key), sizeof(file_view_key));
+        if (!in || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || size[0] != width || size[1] != height)
+        {
+            std::cerr << "Error: " << filepath << " is not a " << width << 'x' << height << " accumulation file" << std::endl;
+            return false;
+        }
+        if (file_view_key != view_key)
+        {
+            std::cerr << "Error: " << filepath << " was rendered with another camera, rotation or seed" << std::endl;
+            return false;
+        }
+
+        std::vector<double> file_sums(sums.size());
+        std::vector<double> file_luminance_sq_sums(luminance_sq_sums.size());
+        std::vector<int32_t> file_counts(counts.size());
+        in.read(reinterpret_cast<char *>(file_sums.data()), file_sums.size() * sizeof(double));
+        in.read(reinterpret_cast<char *>(file_luminance_sq_sums.data()), file_luminance_sq_sums.size() * sizeof(double));
+        in.read(reinterpret_cast<char *>(file_counts.data()), file_counts.size() * sizeof(int32_t));
+        if (!in)
+        {
+            std::cerr << "Error: accumulation file " << filepath << " is truncated" << std::endl;
+            return false;
+        }
+        sums.swap(file_sums);
+        luminance_sq_sums.swap(file_luminance_sq_sums);
+        counts.swap(file_counts);
+        return true;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'R', 'T', 'F', 'I', 'L', 'M', '3', '\n'};
+
+    int width = 0;
+    int height = 0;
+    std::vector<double> sums;              // Linear RGB sums, three per pixel
+    std::vector<double> luminance_sq_sums; // Sums of squared sample luminances
+    std::vector<int32_t> counts;           // Samples per pixel
+};
+
+#endif
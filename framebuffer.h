@@ -0,0 +1,79 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <string>
+#include <vector>
+#include "film.h"
+#include "image_writer.h"
+
+// Linear HDR image in float RGB, plus optional first-hit feature buffers
+// (AOVs) for denoising and compositing. The color is the film's current mean,
+// nothing is clamped or gamma encoded, so emitters keep their intensity.
+class FrameBuffer
+{
+public:
+    std::vector<float> color;  // Linear RGB, three per pixel
+    std::vector<float> albedo; // First-hit albedo, three per pixel, empty without AOVs
+    std::vector<float> normal; // First-hit shading normal in world space, zero for misses
+    std::vector<float> depth;  // First-hit distance from the camera, zero for misses
+
+    FrameBuffer() {}
+    FrameBuffer(int width, int height, bool aovs) : color(size_t(width) * height * 3, 0.0f), width(width), height(height)
+    {
+        if (aovs)
+        {
+            albedo.assign(size_t(width) * height * 3, 0.0f);
+            normal.assign(size_t(width) * height * 3, 0.0f);
+            depth.assign(size_t(width) * height, 0.0f);
+        }
+    }
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    bool has_aovs() const { return !albedo.empty(); }
+
+    // Copy the mean of rows [y_begin, y_end) of the film
+    void resolve(const Film &film, int y_begin, int y_end, bool parallel)
+    {
+#pragma omp parallel for if (parallel)
+        for (int y = y_begin; y < y_end; y++)
+            resolve(film, 0, y, width, y + 1);
+    }
+
+    // Copy the mean of the film in [x0, x1) x [y0, y1)
+    void resolve(const Film &film, int x0, int y0, int x1, int y1)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = x0; x < x1; x++)
+            {
+                vec3 c = film.color(x, y);
+                size_t index = 3 * (size_t(y) * width + x);
+                color[index + 0] = float(c.x());
+                color[index + 1] = float(c.y());
+                color[index + 2] = float(c.z());
+            }
+        }
+    }
+
+    // Linear color as PFM, with the AOVs next to it as <name>_albedo.pfm,
+    // <name>_normal.pfm and <name>_depth.pfm
+    bool save(const std::string &filepath) const
+    {
+        bool ok = write_pfm(filepath, color.data(), width, height, 3);
+        if (has_aovs())
+        {
+            std::string stem = filepath.substr(0, filepath.rfind(".pfm"));
+            ok &= write_pfm(stem + "_albedo.pfm", albedo.data(), width, height, 3);
+            ok &= write_pfm(stem + "_normal.pfm", normal.data(), width, height, 3);
+            ok &= write_pfm(stem + "_depth.pfm", depth.data(), width, height, 1);
+        }
+        return ok;
+    }
+
+private:
+    int width = 0;
+    int height = 0;
+};
+
+#endif
@@ -8,13 +8,23 @@
 #include <memory>
 #include <vector>
 #include <algorithm>
-#include <opencv2/opencv.hpp>
+#include <sstream>
+#include <string>
+#include "sampler.h"
 
 // C++ Standard Library Usings
 
 using std::make_shared;
 using std::shared_ptr;
 
+// Precision of the geometric core (vectors, intervals, boxes, rays, primitives)
+// Configure with -DFLOAT_GEOMETRY=ON for single precision, shading stays in double
+#ifdef FLOAT_GEOMETRY
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 
 const double infinity = std::numeric_limits<double>::infinity();
@@ -27,16 +37,16 @@ inline double degrees_to_radians(double degrees)
     return degrees * pi / 180.0;
 }
 
-inline double random_double()
+inline double random_double(sampler &rng)
 {
     // Returns a random real number in [0,1)
-    return std::rand() / (RAND_MAX + 1.0);
+    return rng.next_double();
 }
 
-inline double random_double(double min, double max)
+inline double random_double(sampler &rng, double min, double max)
 {
     // Returns a random real number in [min,max)
-    return min + (max - min) * random_double();
+    return min + (max - min) * random_double(rng);
 }
 
 inline double linear_to_gamma(double linear_component)
@@ -59,6 +69,7 @@ double normalizeUV(double uv)
 #include "vec3.h"
 #include "interval.h"
 #include "ray.h"
+#include "ray_packet.h"
 #include "bbox.h"
 #include "hittable.h"
 #include "hittable_list.h"
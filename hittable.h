@@ -4,21 +4,45 @@
 #include "bbox.h"
 
 class material;
+class hittable;
+struct BVHNodeInfo;
 
+// Traversal only records t, the primitive and its barycentrics; the surface
+// attributes are filled once by resolve() for the closest hit.
 class hit_record
 {
 public:
-    vec3 p;      // hit point
-    vec3 normal; // face normal
-    shared_ptr<material> mat;
-    double t;
-    double u;
-    double v;
+    real t;
+    const hittable *object = nullptr; // Primitive that was hit
+    const hittable *parent = nullptr; // Instance the primitive was reached through
+    int prim = 0;                     // Triangle index within a mesh
+    real b1 = 0, b2 = 0;              // Barycentrics of triangle hits
+
+    // bvh visual, points into the innermost tree that recorded the hit
+    const BVHNodeInfo *bvh_info = nullptr;
+
+    // Filled by resolve()
+    vec3 p;                // hit point
+    vec3 normal;           // shading normal, against the ray; for BSDFs only
+    vec3 geometric_normal; // face normal, against the ray; offsets secondary ray origins
+    const material *mat = nullptr;
+    real u;
+    real v;
     bool front_face;
 
-    // bvh visual
-    int bvh_depth = 0;
-    std::string bvh_path = "";
+    void set_hit(real hit_t, const hittable *hit_object, int hit_prim = 0, real hit_b1 = 0, real hit_b2 = 0)
+    {
+        t = hit_t;
+        object = hit_object;
+        parent = nullptr;
+        bvh_info = nullptr; // Set by the BVH leaf around the primitive
+        prim = hit_prim;
+        b1 = hit_b1;
+        b2 = hit_b2;
+    }
+
+    // Fill point, normal, material and uv of the recorded hit
+    inline void resolve(const ray &r);
 
     void set_face_normal(const ray &r, const vec3 &outward_normal)
     {
@@ -27,6 +51,18 @@ public:
 
         front_face = r.direction().dot(outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
+        geometric_normal = normal;
+    }
+
+    // Secondary ray leaving the hit point, offset so it cannot hit the same surface again
+    // The offset follows the face normal: an interpolated shading normal can
+    // point to the other side of the real surface at grazing angles.
+    // Objects that set `normal` without set_face_normal() leave the face
+    // normal zero, and the shading normal stands in for it.
+    ray spawn_ray(const vec3 &direction) const
+    {
+        const vec3 &n = geometric_normal.near_zero() ? normal : geometric_normal;
+        return ray(offset_ray_origin(p, n, direction), direction);
     }
 };
 
@@ -35,9 +71,54 @@ class hittable
 public:
     virtual ~hittable() = default;
 
+    // Closest hit in ray_t. A hit must be recorded with rec.set_hit(), which
+    // makes this object the one resolve() is called on; nothing is written to
+    // rec on a miss. Containers pass objects of unknown type a fresh record and
+    // copy it over on a hit, so an object that still fills p, normal and mat in
+    // hit() keeps them instead of having an earlier primitive resolve over them.
     virtual bool hit(const ray &r, interval ray_t, hit_record &rec) const = 0;
 
+    // Packet query for the lanes set in `active`
+    // Records closer hits in recs[lane], shrinks p.t_max and returns the lanes
+    // that hit. The default traces each lane on its own.
+    virtual int hit(ray_packet &p, int active, hit_record *recs) const
+    {
+        int hits = 0;
+        for (int k = 0; k < ray_packet::WIDTH; k++)
+        {
+            if (!(active >> k & 1))
+                continue;
+            hit_record rec;
+            if (hit(p.rays[k], p.lane_interval(k), rec))
+            {
+                recs[k] = rec;
+                p.t_max[k] = rec.t;
+                hits |= 1 << k;
+            }
+        }
+        return hits;
+    }
+
+    // Any-hit query for visibility tests: true when something intersects the
+    // ray in ray_t. No hit record is filled. The default runs a closest hit.
+    virtual bool occluded(const ray &r, interval ray_t) const
+    {
+        hit_record rec;
+        return hit(r, ray_t, rec);
+    }
+
+    // Surface attributes of a hit recorded by this object
+    virtual void resolve(const ray &r, hit_record &rec) const {}
+
     virtual bbox get_bbox() const = 0;
 };
 
+inline void hit_record::resolve(const ray &r)
+{
+    if (parent)
+        parent->resolve(r, *this);
+    else if (object)
+        object->resolve(r, *this);
+}
+
 #endif
@@ -3,12 +3,14 @@
 
 #include "hittable.h"
 #include "bvh.h"
+#include "wide_bvh.h"
 
 class hittable_list : public hittable
 {
 public:
     std::vector<shared_ptr<hittable>> objects;
-    shared_ptr<BVHNode> bvh_tree;
+    shared_ptr<BVH> bvh_tree;
+    shared_ptr<WideBVH> wide_bvh_tree; // Used instead of bvh_tree when built
     bbox b;
 
     hittable_list() : b(bbox::empty) {}
@@ -21,9 +23,53 @@ public:
         b = bbox(b, object->get_bbox());
     }
 
-    void create_bvh_tree(int max_leaf_size = 5, BVHSplitMethod split_method = BVHSplitMethod::MIDDLE)
+    void create_bvh_tree(int max_leaf_size = 5, BVHSplitMethod split_method = BVHSplitMethod::MIDDLE,
+                         bool wide = false, bool parallel = true)
     {
-        bvh_tree = make_shared<BVHNode>(objects, 0, objects.size(), max_leaf_size, split_method);
+        bvh_leaf_size = max_leaf_size;
+        bvh_split_method = split_method;
+        bvh_parallel = parallel;
+        update_bbox();
+        bvh_tree = make_shared<BVH>(objects, max_leaf_size, split_method, parallel);
+        wide_bvh_tree = wide ? make_shared<WideBVH>(bvh_tree) : nullptr;
+    }
+
+    // Update the BVH after objects moved in place
+    // The tree is refitted, and rebuilt only when the refit raised its SAH cost
+    // above `rebuild_ratio` times the cost after the last build (always when
+    // the ratio is 0). Returns true when the tree was rebuilt.
+    bool update_bvh_tree(double rebuild_ratio)
+    {
+        update_bbox();
+        if (!bvh_tree)
+            return false;
+
+        if (rebuild_ratio > 0)
+        {
+            bvh_tree->refit();
+            if (bvh_tree->sah_cost() <= rebuild_ratio * bvh_tree->build_cost)
+            {
+                if (wide_bvh_tree)
+                    wide_bvh_tree = make_shared<WideBVH>(bvh_tree); // Collapsing is linear, no need to refit
+                return false;
+            }
+        }
+        create_bvh_tree(bvh_leaf_size, bvh_split_method, wide_bvh_tree != nullptr, bvh_parallel);
+        return true;
+    }
+
+    // Recompute the bounds after objects moved in place
+    void update_bbox()
+    {
+        b = bbox::empty;
+        for (const auto &object : objects)
+            b = bbox(b, object->get_bbox());
+    }
+
+    // Counters of the tree used for traversal
+    BVHStats &bvh_stats()
+    {
+        return wide_bvh_tree ? wide_bvh_tree->stats : bvh_tree->stats;
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
@@ -34,13 +80,47 @@ public:
             return false;
         }
 
+        if (wide_bvh_tree)
+            return wide_bvh_tree->hit(r, ray_t, rec);
         return bvh_tree->hit(r, ray_t, rec);
     }
 
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        if (!bvh_tree)
+        {
+            std::cerr << "Error: BVH tree not created. Call create_bvh_tree() first." << std::endl;
+            return false;
+        }
+
+        if (wide_bvh_tree)
+            return wide_bvh_tree->occluded(r, ray_t);
+        return bvh_tree->occluded(r, ray_t);
+    }
+
+    int hit(ray_packet &p, int active, hit_record *recs) const override
+    {
+        if (!bvh_tree)
+        {
+            std::cerr << "Error: BVH tree not created. Call create_bvh_tree() first." << std::endl;
+            return 0;
+        }
+
+        if (wide_bvh_tree)
+            return wide_bvh_tree->hit(p, active, recs);
+        return bvh_tree->hit(p, active, recs);
+    }
+
     bbox get_bbox() const override
     {
         return b;
     }
+
+private:
+    // Build settings, reused when update_bvh_tree() rebuilds
+    int bvh_leaf_size = 5;
+    BVHSplitMethod bvh_split_method = BVHSplitMethod::MIDDLE;
+    bool bvh_parallel = true;
 };
 
 #endif
@@ -0,0 +1,172 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Image files written without OpenCV, for headless builds and farm jobs
+// 8-bit images are BGR rows, the layout of Screen's image buffer.
+
+// Binary PPM (P6)
+inline bool write_ppm(const std::string &filepath, const unsigned char *bgr, int width, int height)
+{
+    std::ofstream out(filepath, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "Error: Cannot write \"" << filepath << "\"." << std::endl;
+        return false;
+    }
+
+    out << "P6\n"
+        << width << " " << height << "\n255\n";
+    std::vector<char> row(size_t(width) * 3);
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char *src = bgr + size_t(y) * width * 3;
+        for (int x = 0; x < width; x++)
+        {
+            row[x * 3 + 0] = src[x * 3 + 2];
+            row[x * 3 + 1] = src[x * 3 + 1];
+            row[x * 3 + 2] = src[x * 3 + 0];
+        }
+        out.write(row.data(), row.size());
+    }
+    return bool(out);
+}
+
+// PNG with uncompressed (stored) deflate blocks
+// No zlib needed, the file is about as large as the raw pixels.
+inline bool write_png(const std::string &filepath, const unsigned char *bgr, int width, int height)
+{
+    static uint32_t crc_table[256];
+    static bool crc_ready = []
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            crc_table[n] = c;
+        }
+        return true;
+    }();
+    (void)crc_ready;
+
+    auto put32 = [](std::vector<unsigned char> &buf, uint32_t v)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            buf.push_back((v >> shift) & 0xff);
+    };
+
+    // Chunk = length, type, data, CRC of type and data
+    std::vector<unsigned char> file = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    auto put_chunk = [&](const char *type, const std::vector<unsigned char> &data)
+    {
+        put32(file, uint32_t(data.size()));
+        size_t start = file.size();
+        file.insert(file.end(), type, type + 4);
+        file.insert(file.end(), data.begin(), data.end());
+        uint32_t crc = 0xffffffffu;
+        for (size_t i = start; i < file.size(); i++)
+            crc = crc_table[(crc ^ file[i]) & 0xff] ^ (crc >> 8);
+        put32(file, crc ^ 0xffffffffu);
+    };
+
+    std::vector<unsigned char> header;
+    put32(header, width);
+    put32(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0}); // 8-bit RGB, no interlace
+    put_chunk("IHDR", header);
+
+    // Rows of RGB, each after a filter type byte of 0 (none)
+    std::vector<unsigned char> raw;
+    raw.reserve(size_t(height) * (1 + size_t(width) * 3));
+    for (int y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        const unsigned char *src = bgr + size_t(y) * width * 3;
+        for (int x = 0; x < width; x++)
+            raw.insert(raw.end(), {src[x * 3 + 2], src[x * 3 + 1], src[x * 3 + 0]});
+    }
+
+    // zlib stream of stored blocks of at most 65535 bytes
+    std::vector<unsigned char> idat = {0x78, 0x01};
+    for (size_t pos = 0; pos < raw.size(); pos += 65535)
+    {
+        size_t len = std::min<size_t>(65535, raw.size() - pos);
+        bool last = pos + len == raw.size();
+        idat.insert(idat.end(), {(unsigned char)(last ? 1 : 0),
+                                 (unsigned char)(len & 0xff), (unsigned char)(len >> 8),
+                                 (unsigned char)(~len & 0xff), (unsigned char)((~len >> 8) & 0xff)});
+        idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+    }
+    uint32_t a = 1, b = 0;
+    for (unsigned char c : raw)
+    {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(idat, (b << 16) | a);
+    put_chunk("IDAT", idat);
+    put_chunk("IEND", {});
+
+    std::ofstream out(filepath, std::ios::binary);
+    if (!out || !out.write((const char *)file.data(), file.size()))
+    {
+        std::cerr << "Error: Cannot write \"" << filepath << "\"." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Float PFM, "PF" for three channels and "Pf" for one
+// PFM stores the bottom row first, rows are written straight from `data`.
+inline bool write_pfm(const std::string &filepath, const float *data, int width, int height, int channels)
+{
+    std::ofstream out(filepath, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "Error: Cannot write \"" << filepath << "\"." << std::endl;
+        return false;
+    }
+
+    // A negative scale marks little-endian floats
+    const uint16_t probe = 1;
+    bool little_endian = *reinterpret_cast<const unsigned char *>(&probe) == 1;
+    out << (channels == 3 ? "PF\n" : "Pf\n")
+        << width << " " << height << "\n"
+        << (little_endian ? "-1.0\n" : "1.0\n");
+    size_t row_size = size_t(width) * channels;
+    for (int y = height - 1; y >= 0; y--)
+        out.write(reinterpret_cast<const char *>(data + y * row_size), row_size * sizeof(float));
+    return bool(out);
+}
+
+inline bool has_extension(const std::string &filepath, const std::string &ext)
+{
+    return filepath.size() >= ext.size() && filepath.compare(filepath.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+// True for the formats write_image handles
+inline bool is_builtin_image_format(const std::string &filepath)
+{
+    return has_extension(filepath, ".png") || has_extension(filepath, ".ppm");
+}
+
+// Format chosen by the file extension, .png or .ppm
+inline bool write_image(const std::string &filepath, const unsigned char *bgr, int width, int height)
+{
+    if (has_extension(filepath, ".png"))
+        return write_png(filepath, bgr, width, height);
+    if (has_extension(filepath, ".ppm"))
+        return write_ppm(filepath, bgr, width, height);
+
+    std::cerr << "Error: Unsupported image format \"" << filepath << "\", use .png or .ppm." << std::endl;
+    return false;
+}
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include <Eigen/Eigen>
+
+// Placed copy of a shared object (usually the BVH of a mesh)
+// The object keeps its own bottom-level BVH, built once. Rays are moved into
+// object space instead of moving the geometry, so any number of instances
+// share one copy of the triangles, and moving an instance only changes the
+// top-level tree that holds it.
+class instance : public hittable
+{
+public:
+    instance(shared_ptr<hittable> object, const Eigen::Matrix4f &transform)
+        : object(object)
+    {
+        set_transform(transform);
+    }
+
+    // Object to world transform, as composed by ObjLoader
+    void set_transform(const Eigen::Matrix4f &transform)
+    {
+        to_world = transform.cast<double>();
+        to_object = to_world.inverse();
+        update_bbox();
+    }
+
+    // Swap in another object, e.g. the same mesh under a rebuilt BVH
+    void set_object(shared_ptr<hittable> new_object)
+    {
+        object = new_object;
+        update_bbox();
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        // The direction is not normalized, so t is the same in both spaces
+        ray local(apply(to_object, r.origin(), 1), apply(to_object, r.direction(), 0));
+        hit_record local_rec;
+        if (!object->hit(local, ray_t, local_rec))
+            return false;
+
+        rec = local_rec;
+        rec.parent = this;
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        ray local(apply(to_object, r.origin(), 1), apply(to_object, r.direction(), 0));
+        return object->occluded(local, ray_t);
+    }
+
+    void resolve(const ray &r, hit_record &rec) const override
+    {
+        ray local(apply(to_object, r.origin(), 1), apply(to_object, r.direction(), 0));
+        if (rec.object)
+            rec.object->resolve(local, rec);
+
+        // Normals use the inverse transpose, which keeps their side of the ray
+        rec.p = apply(to_world, rec.p, 1);
+        rec.normal = apply_transposed(to_object, rec.normal).normalized();
+        if (!rec.geometric_normal.near_zero())
+            rec.geometric_normal = apply_transposed(to_object, rec.geometric_normal).normalized();
+    }
+
+    bbox get_bbox() const override
+    {
+        return b;
+    }
+
+private:
+    shared_ptr<hittable> object;
+    Eigen::Matrix4d to_world;
+    Eigen::Matrix4d to_object;
+    bbox b;
+
+    // World bounds of the eight corners of the object box
+    void update_bbox()
+    {
+        bbox ob = object->get_bbox();
+        b = bbox::empty;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            vec3 p((corner & 1 ? ob.x.max : ob.x.min),
+                   (corner & 2 ? ob.y.max : ob.y.min),
+                   (corner & 4 ? ob.z.max : ob.z.min));
+            b = bbox(b, apply(to_world, p, 1));
+        }
+    }
+
+    // Points use w = 1, directions w = 0
+    static vec3 apply(const Eigen::Matrix4d &m, const vec3 &v, double w)
+    {
+        return vec3(m(0, 0) * v.x() + m(0, 1) * v.y() + m(0, 2) * v.z() + m(0, 3) * w,
+                    m(1, 0) * v.x() + m(1, 1) * v.y() + m(1, 2) * v.z() + m(1, 3) * w,
+                    m(2, 0) * v.x() + m(2, 1) * v.y() + m(2, 2) * v.z() + m(2, 3) * w);
+    }
+
+    static vec3 apply_transposed(const Eigen::Matrix4d &m, const vec3 &v)
+    {
+        return vec3(m(0, 0) * v.x() + m(1, 0) * v.y() + m(2, 0) * v.z(),
+                    m(0, 1) * v.x() + m(1, 1) * v.y() + m(2, 1) * v.z(),
+                    m(0, 2) * v.x() + m(1, 2) * v.y() + m(2, 2) * v.z());
+    }
+};
+
+#endif
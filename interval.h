@@ -4,10 +4,10 @@
 class interval
 {
 public:
-    double min, max;
+    real min, max;
 
     interval() {}
-    interval(double min, double max) : min(min), max(max) {}
+    interval(real min, real max) : min(min), max(max) {}
 
     // merge two intervals
     interval(const interval &a, const interval &b)
@@ -16,29 +16,29 @@ public:
         max = a.max > b.max ? a.max : b.max;
     }
 
-    double size() const
+    real size() const
     {
         if (min > max)
             return 0.0;
         return max - min;
     }
 
-    bool contains(double x) const
+    bool contains(real x) const
     {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const
+    bool surrounds(real x) const
     {
         return min < x && x < max;
     }
 
-    interval pad(double s) const
+    interval pad(real s) const
     {
         return interval(min - s, max + s);
     }
 
-    double clamp(double x) const
+    real clamp(real x) const
     {
         if (x < min)
             return min;
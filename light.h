@@ -0,0 +1,53 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "sphere.h"
+#include "material.h"
+
+// Emitters sampled directly by next-event estimation
+// Collected once at scene build from the top-level spheres whose material
+// emits. Scenes have a handful of lights, so lookups are linear.
+class light_list
+{
+public:
+    std::vector<shared_ptr<sphere>> spheres;
+
+    light_list() {}
+
+    light_list(const std::vector<shared_ptr<hittable>> &objects)
+    {
+        for (const auto &object : objects)
+        {
+            auto s = std::dynamic_pointer_cast<sphere>(object);
+            if (s && s->mat && s->mat->is_emissive())
+                spheres.push_back(s);
+        }
+    }
+
+    bool empty() const { return spheres.empty(); }
+    size_t size() const { return spheres.size(); }
+
+    // Pick a light uniformly and a direction towards it from `origin`
+    // `pdf` is the solid angle density of the direction, including the light choice.
+    const sphere *sample(const vec3 &origin, sampler &rng, vec3 &direction, double &pdf) const
+    {
+        size_t n = spheres.size();
+        const sphere *light = spheres[std::min(n - 1, size_t(random_double(rng) * n))].get();
+        direction = light->sample_direction(origin, rng);
+        pdf = light->pdf_direction(origin) / n;
+        return light;
+    }
+
+    // Density of sample() choosing a direction that reaches `object`, 0 when it is not a light
+    double pdf(const vec3 &origin, const hittable *object) const
+    {
+        for (const auto &light : spheres)
+        {
+            if (light.get() == object)
+                return light->pdf_direction(origin) / spheres.size();
+        }
+        return 0;
+    }
+};
+
+#endif
@@ -5,6 +5,107 @@
 #include "timer.h"
 #include "objloader.h"
 #include "config.h"
+#include "benchmark.h"
+#include "instance.h"
+
+// Print traversal statistics of the last render
+void report_bvh_stats(ScopedTimer &timer, const BVHStats &stats, long long render_ms)
+{
+    double rays = double(stats.rays);
+    if (rays == 0)
+        return;
+    timer.report("Rays traced", rays);
+    timer.report("Traversal steps per ray", stats.steps / rays);
+    timer.report("Primitive tests per ray", stats.prim_tests / rays);
+    timer.report("Rays per second", rays / (std::max(render_ms, 1LL) / 1000.0));
+}
+
+// Print how the render time was spread over the tiles
+// Busy time is the summed tile time over threads x render time, 100% means no thread idled.
+void report_tile_stats(ScopedTimer &timer, const TileStats &stats, long long render_ms, int threads)
+{
+    if (stats.ms.empty())
+        return;
+    timer.report("Tiles", double(stats.ms.size()));
+    timer.report("Tile time (mean)", stats.mean_ms(), "ms");
+    timer.report("Tile time (max)", stats.max_ms(), "ms");
+    timer.report("Tile steals", double(stats.steals));
+    timer.report("Thread busy time", 100.0 * stats.total_ms() / (double(std::max(render_ms, 1LL)) * threads), "%");
+}
+
+// Print how far the output is from a reference render
+// Renders with different seeds give the noise level to compare against.
+void report_image_diff(ScopedTimer &timer, const Screen &screen, const std::string &reference)
+{
+    double mean_diff;
+    int max_diff;
+    if (!screen.compare(reference, mean_diff, max_diff))
+    {
+        std::cerr << "Error: Failed to compare with \"" << reference << "\"." << std::endl;
+        return;
+    }
+    timer.report("Image diff (mean)", mean_diff);
+    timer.report("Image diff (max)", max_diff);
+}
+
+// FNV-1a hash of what a film's samples depend on besides the scene: the
+// camera, the scene rotation and the seed
+uint64_t film_view_key(const Config &config)
+{
+    double values[] = {config.camera_lookfrom.x(), config.camera_lookfrom.y(), config.camera_lookfrom.z(),
+                       config.camera_lookat.x(), config.camera_lookat.y(), config.camera_lookat.z(),
+                       double(config.camera_vfov), double(config.rotate_degree), double(config.seed)};
+    uint64_t hash = 14695981039346656037ULL;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(values);
+    for (size_t i = 0; i < sizeof(values); i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+// Continue the accumulation saved in `path`, when there is one for the same view
+void resume_film(camera &cam, const std::string &path, uint64_t view_key)
+{
+    cam.film.view_key = view_key;
+    if (path.empty())
+        return;
+    if (cam.film.load(path))
+        std::cout << "Resuming accumulation from " << path << ", "
+                  << cam.film.sample_count(0, cam.image_height - 1) << " samples per pixel so far\n";
+}
+
+// Samples actually taken, and where, when adaptive sampling chose them
+void report_samples(ScopedTimer &timer, const camera &cam, const Config &config)
+{
+    if (config.adaptive_threshold > 0)
+        timer.report("Average samples per pixel", cam.average_samples());
+    if (!config.heatmap_file.empty())
+        cam.save_sample_heatmap(config.heatmap_file);
+}
+
+// BVH construction method selected on the command line
+BVHSplitMethod bvh_split_method(const Config &config)
+{
+    if (config.bvh_lbvh == 1)
+        return BVHSplitMethod::LBVH;
+    if (config.bvh_lbvh == 2)
+        return BVHSplitMethod::HLBVH;
+    return config.bvh_sah ? BVHSplitMethod::SAH : BVHSplitMethod::MIDDLE;
+}
+
+// Lay instances of a mesh out on a square grid, each with the mesh transform
+void place_instances(std::vector<shared_ptr<instance>> &instances, const bbox &mesh_box,
+                     const Eigen::Matrix4f &transform)
+{
+    int side = int(std::ceil(std::sqrt(double(instances.size()))));
+    double spacing = 1.5 * std::max(mesh_box.x.size(), mesh_box.z.size());
+    for (size_t k = 0; k < instances.size(); k++)
+    {
+        Eigen::Matrix4f placement = Eigen::Matrix4f::Identity();
+        placement(0, 3) = float(int(k) % side * spacing);
+        placement(2, 3) = float(-(int(k) / side) * spacing);
+        instances[k]->set_transform(placement * transform);
+    }
+}
 
 int main(int argc, char *argv[])
 {
@@ -36,21 +137,57 @@ int main(int argc, char *argv[])
 
     ObjLoader loader;
 
-    std::srand(42);
     timer.start_timer("Load");
     // loader.read_obj("model/cow.obj", "model/cow2.png");
-    loader.read_obj_with_mtl("model/room/room.obj", "model/room/room.mtl");
+    loader.read_obj_with_mtl("model/room/room.obj", "model/room/room.mtl", config.indexed_mesh);
     timer.stop_timer();
 
     timer.start_timer("Transformation");
     loader.set_rotate(config.rotate_degree, vec3(0, 1, 0));
     // loader.set_scale(0.9);
     // loader.set_translate(0.1, 0.1, 0);
-    loader.apply_transformation();
+    if (config.instances == 0)
+        loader.apply_transformation();
     timer.stop_timer();
 
-    for (size_t i = 0; i < loader.triangles.size(); i++)
-        world.add(loader.triangles[i]);
+    // An indexed mesh is one hittable with its own BVH over triangle indices
+    shared_ptr<mesh> indexed_mesh = loader.indexed_mesh;
+    if (indexed_mesh)
+    {
+        timer.start_timer("Mesh BVH build");
+        indexed_mesh->create_bvh_tree(5, bvh_split_method(config), config.use_openmp);
+        timer.stop_timer();
+        timer.report("Mesh bytes per triangle", double(indexed_mesh->memory_bytes()) / indexed_mesh->triangle_count());
+    }
+
+    // Two-level BVH: the mesh gets its own bottom-level tree, shared by all
+    // instances, and the world tree only holds the instances and spheres
+    shared_ptr<hittable> mesh_bvh = indexed_mesh;
+    std::vector<shared_ptr<instance>> instances;
+    if (config.instances > 0)
+    {
+        if (!indexed_mesh)
+        {
+            timer.start_timer("Mesh BVH build");
+            std::vector<shared_ptr<hittable>> triangles(loader.triangles.begin(), loader.triangles.end());
+            mesh_bvh = make_shared<BVH>(triangles, 5, bvh_split_method(config), config.use_openmp);
+            timer.stop_timer();
+        }
+
+        for (int k = 0; k < config.instances; k++)
+            instances.push_back(make_shared<instance>(mesh_bvh, loader.get_transformation()));
+        place_instances(instances, mesh_bvh->get_bbox(), loader.get_transformation());
+        loader.reset_transformation();
+        for (const auto &inst : instances)
+            world.add(inst);
+    }
+    else if (indexed_mesh)
+        world.add(indexed_mesh);
+    else
+    {
+        for (size_t i = 0; i < loader.triangles.size(); i++)
+            world.add(loader.triangles[i]);
+    }
 
     camera cam;
 
@@ -58,6 +195,18 @@ int main(int argc, char *argv[])
     cam.image_height = 520;
     cam.samples_per_pixel = config.sample_num;
     cam.max_depth = config.max_depth;
+    cam.russian_roulette = config.russian_roulette;
+    cam.next_event = config.next_event;
+    cam.lights = light_list(world.objects);
+    cam.seed = config.seed;
+    cam.use_packets = config.use_packets;
+    cam.progressive = config.progressive;
+    cam.adaptive_threshold = config.adaptive_threshold;
+    cam.tile_size = config.tile_size;
+    cam.display_fps = config.display_fps;
+    cam.aovs = config.aovs || config.denoise;
+    cam.exposure = config.exposure;
+    cam.reinhard = config.reinhard;
 
     // Black background
     cam.background_color = vec3(1, 1, 1);
@@ -82,22 +231,51 @@ int main(int argc, char *argv[])
 
     show_config(config);
     std::cout << "Objects number: " << world.objects.size() << std::endl;
+    std::cout << "Lights number: " << cam.lights.size() << std::endl;
     std::cout << "image size: " << cam.image_width << 'x' << cam.image_height << std::endl;
 
     // Create BVH tree
-    bool sah = config.bvh_sah;
+    BVHSplitMethod split_method = bvh_split_method(config);
+    bool wide = config.bvh_wide;
+    int rotate_degree = config.rotate_degree;
     timer.start_timer("BVH build");
-    world.create_bvh_tree(5, sah ? BVHSplitMethod::SAH : BVHSplitMethod::MIDDLE);
+    world.create_bvh_tree(5, split_method, wide, config.use_openmp);
     timer.stop_timer();
 
+    if (config.bench_rays > 0)
+        benchmark_node_tests(*world.bvh_tree, config.camera_lookfrom, config.bench_rays, config.seed);
+
     // Rendering process
+    world.bvh_stats().enabled = config.bvh_stats;
+    world.bvh_stats().reset();
     timer.start_timer("Render");
     cam.initialize();
-    cam.render(world, true, config.use_openmp, config.use_sample_rate);
-    timer.stop_timer();
+    uint64_t view_key = film_view_key(config);
+    resume_film(cam, config.film_file, view_key);
+    cam.render(world, config.display, config.use_openmp, config.use_sample_rate);
+    long long render_ms = timer.stop_timer();
+    if (config.bvh_stats)
+    {
+        report_bvh_stats(timer, world.bvh_stats(), render_ms);
+        report_tile_stats(timer, cam.tiles.stats, render_ms, config.use_openmp ? omp_get_max_threads() : 1);
+    }
+    if (config.denoise)
+    {
+        timer.start_timer("Denoise");
+        cam.denoise(config.use_openmp);
+        timer.stop_timer();
+    }
 
-    cam.screen.save("output.png");
-    cam.screen.display(1);
+    cam.screen.save(config.output_file);
+    if (!config.hdr_file.empty())
+        cam.framebuffer.save(config.hdr_file);
+    if (!config.film_file.empty())
+        cam.film.save(config.film_file);
+    report_samples(timer, cam, config);
+    if (!config.compare_image.empty())
+        report_image_diff(timer, cam.screen, config.compare_image);
+    if (config.display)
+        cam.screen.display(1);
 
     while (config.ci)
     {
@@ -122,26 +300,120 @@ int main(int argc, char *argv[])
 
         cam.samples_per_pixel = config.sample_num;
         cam.max_depth = config.max_depth;
+        cam.russian_roulette = config.russian_roulette;
+        cam.next_event = config.next_event;
+        cam.seed = config.seed;
+        cam.use_packets = config.use_packets;
+        cam.progressive = config.progressive;
+        cam.adaptive_threshold = config.adaptive_threshold;
+        cam.tile_size = config.tile_size;
+        cam.display_fps = config.display_fps;
+        cam.aovs = config.aovs || config.denoise;
+        cam.exposure = config.exposure;
+        cam.reinhard = config.reinhard;
         cam.lookfrom = config.camera_lookfrom;
         cam.lookat = config.camera_lookat;
         cam.vfov = config.camera_vfov;
 
-        if (config.bvh_sah != sah)
+        // Rotate the mesh in place by the change of angle
+        bool rotated = config.rotate_degree != rotate_degree;
+        if (rotated && !instances.empty())
         {
-            sah = config.bvh_sah;
+            // Only the instance transforms change, the mesh and its BVH stay
+            timer.start_timer("Transformation");
+            loader.set_rotate(config.rotate_degree, vec3(0, 1, 0));
+            place_instances(instances, mesh_bvh->get_bbox(), loader.get_transformation());
+            loader.reset_transformation();
+            timer.stop_timer();
+            rotate_degree = config.rotate_degree;
+        }
+        else if (rotated)
+        {
+            timer.start_timer("Transformation");
+            loader.set_rotate(config.rotate_degree - rotate_degree, vec3(0, 1, 0));
+            loader.apply_transformation();
+            if (indexed_mesh)
+                indexed_mesh->refit();
+            timer.stop_timer();
+            rotate_degree = config.rotate_degree;
+        }
+
+        if (bvh_split_method(config) != split_method || config.bvh_wide != wide)
+        {
+            if (bvh_split_method(config) != split_method && (indexed_mesh || !instances.empty()))
+            {
+                // The mesh's own tree follows the split method too
+                timer.start_timer("Mesh BVH build");
+                if (indexed_mesh)
+                    indexed_mesh->create_bvh_tree(5, bvh_split_method(config), config.use_openmp);
+                else
+                {
+                    std::vector<shared_ptr<hittable>> triangles(loader.triangles.begin(), loader.triangles.end());
+                    mesh_bvh = make_shared<BVH>(triangles, 5, bvh_split_method(config), config.use_openmp);
+                    for (const auto &inst : instances)
+                        inst->set_object(mesh_bvh);
+                }
+                timer.stop_timer();
+            }
+
+            // create_bvh_tree also recomputes the world bounds after a rotation
+            split_method = bvh_split_method(config);
+            wide = config.bvh_wide;
             timer.start_timer("BVH build");
-            world.create_bvh_tree(5, sah ? BVHSplitMethod::SAH : BVHSplitMethod::MIDDLE);
+            world.create_bvh_tree(5, split_method, wide, config.use_openmp);
             timer.stop_timer();
         }
+        else if (rotated)
+        {
+            // Refit unless the tree got too slow, the top level of a
+            // two-level BVH is small enough to always be rebuilt
+            timer.start_timer("BVH update");
+            bool rebuilt = world.update_bvh_tree(instances.empty() ? config.bvh_rebuild_ratio : 0);
+            timer.stop_timer();
+            std::cout << (rebuilt ? "BVH rebuilt" : "BVH refitted") << ", SAH cost "
+                      << world.bvh_tree->sah_cost() << " (after build: " << world.bvh_tree->build_cost << ")\n";
+        }
 
+        world.bvh_stats().enabled = config.bvh_stats;
+        world.bvh_stats().reset();
         timer.start_timer("Render");
         cam.initialize();
-        cam.render(world, true, config.use_openmp, config.use_sample_rate);
-        timer.stop_timer();
+        if (film_view_key(config) != view_key)
+        {
+            // The saved samples belong to the old view, the next save replaces them
+            view_key = film_view_key(config);
+            cam.film.view_key = view_key;
+            if (!config.film_file.empty())
+                std::cout << "View changed, starting a new accumulation\n";
+        }
+        else
+            resume_film(cam, config.film_file, view_key);
+        cam.render(world, config.display, config.use_openmp, config.use_sample_rate);
+        long long render_ms = timer.stop_timer();
+        if (config.bvh_stats)
+        {
+            report_bvh_stats(timer, world.bvh_stats(), render_ms);
+            report_tile_stats(timer, cam.tiles.stats, render_ms, config.use_openmp ? omp_get_max_threads() : 1);
+        }
+        if (config.denoise)
+        {
+            timer.start_timer("Denoise");
+            cam.denoise(config.use_openmp);
+            timer.stop_timer();
+        }
 
-        cam.screen.save("output.png");
-        cam.screen.display(1);
+        cam.screen.save(config.output_file);
+        if (!config.hdr_file.empty())
+            cam.framebuffer.save(config.hdr_file);
+        if (!config.film_file.empty())
+            cam.film.save(config.film_file);
+        report_samples(timer, cam, config);
+        if (!config.compare_image.empty())
+            report_image_diff(timer, cam.screen, config.compare_image);
+        if (config.display)
+            cam.screen.display(1);
     }
 
-    cam.screen.display(0);
+    if (config.display)
+        cam.screen.display(0);
 }
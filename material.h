@@ -10,7 +10,7 @@ public:
     virtual ~material() = default;
 
     virtual bool scatter(
-        const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered) const
+        const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered, sampler &rng) const
     {
         return false;
     }
@@ -25,6 +25,26 @@ public:
     {
         return sample_num;
     }
+
+    // Emitters are collected into the light list for next-event estimation
+    virtual bool is_emissive() const
+    {
+        return false;
+    }
+
+    // Reflectance at a first hit, for the albedo AOV
+    // Specular and refractive surfaces report white, as denoisers expect.
+    virtual vec3 albedo(const hit_record &rec) const
+    {
+        return vec3(1, 1, 1);
+    }
+
+    // Albedo of an ideal diffuse surface, whose scatter() samples the cosine
+    // lobe around rec.normal. Only these surfaces sample lights directly.
+    virtual bool diffuse_albedo(const hit_record &rec, vec3 &albedo) const
+    {
+        return false;
+    }
 };
 
 class lambertian : public material
@@ -39,20 +59,31 @@ public:
         return std::max(1, sample_num);
     }
 
-    bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered)
+    bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered, sampler &rng)
         const override
     {
-        vec3 scatter_direction = rec.normal + random_unit_vector();
+        vec3 scatter_direction = rec.normal + random_unit_vector(rng);
 
         // Catch degenerate scatter direction
         if (scatter_direction.near_zero())
             scatter_direction = rec.normal;
 
-        scattered = ray(rec.p, scatter_direction);
+        scattered = rec.spawn_ray(scatter_direction);
         attenuation = tex->value(rec.u, rec.v);
         return true;
     }
 
+    vec3 albedo(const hit_record &rec) const override
+    {
+        return tex->value(rec.u, rec.v);
+    }
+
+    bool diffuse_albedo(const hit_record &rec, vec3 &albedo) const override
+    {
+        albedo = tex->value(rec.u, rec.v);
+        return true;
+    }
+
 private:
     shared_ptr<texture> tex;
 };
@@ -82,7 +113,7 @@ public:
     {
         // Visualize object depth in BVH tree
         // Reddish image indicates BVH tree nodes generally exceed h/2 depth
-        emit_color = convert_int_to_color(rec.bvh_depth, h);
+        emit_color = convert_int_to_color(rec.bvh_info ? rec.bvh_info->depth : 0, h);
         return true;
     }
 };
@@ -102,15 +133,17 @@ public:
         int t1 = 0;
         int t2 = pow(2, h - root.length() + 1) - 2;
 
-        if (rec.bvh_path.length() >= root.length())
+        static const std::string no_path;
+        const std::string &bvh_path = rec.bvh_info ? rec.bvh_info->path : no_path;
+        if (bvh_path.length() >= root.length())
         {
             // Must start from specified root
-            std::string prefix = rec.bvh_path.substr(0, root.length());
+            std::string prefix = bvh_path.substr(0, root.length());
             if (prefix == root)
             {
                 // Extract remaining path string, but not exceeding max depth
-                int n = rec.bvh_path.length();
-                std::string s = rec.bvh_path.substr(root.length(), std::min(n, h) - root.length());
+                int n = bvh_path.length();
+                std::string s = bvh_path.substr(root.length(), std::min(n, h) - root.length());
 
                 // Calculate mapping
                 t1 = binaryStringToInt2(s);
@@ -152,16 +185,21 @@ public:
         return std::max(1, sample_num);
     }
 
-    bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered)
+    bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered, sampler &rng)
         const override
     {
         vec3 reflected = reflect(r_in.direction(), rec.normal);
-        reflected = reflected.normalized() + (fuzz * random_unit_vector());
-        scattered = ray(rec.p, reflected);
+        reflected = reflected.normalized() + (fuzz * random_unit_vector(rng));
+        scattered = rec.spawn_ray(reflected);
         attenuation = tex->value(rec.u, rec.v);
         return (scattered.direction().dot(rec.normal) > 0);
     }
 
+    vec3 albedo(const hit_record &rec) const override
+    {
+        return tex->value(rec.u, rec.v);
+    }
+
 private:
     double fuzz;
     shared_ptr<texture> tex;
@@ -179,6 +217,16 @@ public:
         return true;
     }
 
+    bool is_emissive() const override
+    {
+        return true;
+    }
+
+    vec3 albedo(const hit_record &rec) const override
+    {
+        return color;
+    }
+
 private:
     vec3 color;
     double intensity;
@@ -189,7 +237,7 @@ class glass : public material
 public:
     glass(double refraction_index) : refraction_index(refraction_index) {}
 
-    bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered)
+    bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered, sampler &rng)
         const override
     {
         attenuation = vec3(1.0, 1.0, 1.0);
@@ -202,12 +250,12 @@ public:
         bool cannot_refract = ri * sin_theta > 1.0;
         vec3 direction;
 
-        if (cannot_refract || reflectance(cos_theta, ri) > random_double())
+        if (cannot_refract || reflectance(cos_theta, ri) > random_double(rng))
             direction = reflect(unit_direction, rec.normal);
         else
             direction = refract(unit_direction, rec.normal, ri);
 
-        scattered = ray(rec.p, direction);
+        scattered = rec.spawn_ray(direction);
         return true;
     }
 
@@ -260,15 +308,15 @@ public:
         pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
     }
 
-    bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered)
+    bool scatter(const ray &r_in, const hit_record &rec, vec3 &attenuation, ray &scattered, sampler &rng)
         const override
     {
-        if (random_double() < 0.1)
+        if (random_double(rng) < 0.1)
         {
             double fuzz = 0.5;
             vec3 reflected = reflect(r_in.direction(), rec.normal);
-            reflected = reflected.normalized() + (fuzz * random_unit_vector());
-            scattered = ray(rec.p, reflected);
+            reflected = reflected.normalized() + (fuzz * random_unit_vector(rng));
+            scattered = rec.spawn_ray(reflected);
             attenuation = vec3(0.1, 0.1, 0.1);
             return (scattered.direction().dot(rec.normal) > 0);
         }
@@ -276,7 +324,7 @@ public:
         int i = int((rec.u) * image_width);
         int j = int((1 - rec.v) * image_height);
 
-        scattered = get_ray(i, j);
+        scattered = get_ray(i, j, rng);
         attenuation = vec3(1, 1, 1);
         return true;
     }
@@ -291,10 +339,10 @@ private:
     vec3 pixel_delta_v;        // Down pixel offset
     vec3 u, v, w;              // Camera frame basis vectors
 
-    ray get_ray(int i, int j) const
+    ray get_ray(int i, int j, sampler &rng) const
     {
         // Construct camera ray directed at random point around pixel (i,j)
-        auto offset = sample_square();
+        auto offset = sample_square(rng);
         auto pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_u) + ((j + offset.y()) * pixel_delta_v);
 
         auto ray_origin = center;
@@ -303,10 +351,10 @@ private:
         return ray(ray_origin, ray_direction);
     }
 
-    vec3 sample_square() const
+    vec3 sample_square(sampler &rng) const
     {
         // Return random point in [-0.5,-0.5] to [0.5,0.5] unit square
-        return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+        return vec3(random_double(rng) - 0.5, random_double(rng) - 0.5, 0);
     }
 };
 
@@ -0,0 +1,173 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "hittable.h"
+#include "triangle.h"
+
+// Indexed triangle mesh
+// Vertices are stored once and shared by all triangles that use them, each
+// triangle is three vertex indices and a material id. The mesh keeps its own
+// BVH whose leaves are ranges of triangle indices, and the triangles are
+// stored in leaf order, so a leaf reads one contiguous block of indices.
+class mesh : public hittable
+{
+public:
+    // Vertex attributes, one entry per unique position/uv/normal combination
+    std::vector<vec3> positions;
+    std::vector<vec3> normals; // Zero when the file has none
+    std::vector<real> us;
+    std::vector<real> vs;
+
+    // Triangles
+    std::vector<uint32_t> indices; // Three per triangle
+    std::vector<uint16_t> material_ids;
+    std::vector<shared_ptr<material>> materials;
+
+    shared_ptr<BVH> bvh;
+
+    size_t triangle_count() const { return material_ids.size(); }
+
+    uint32_t add_vertex(const vec3 &pos, real u, real v, const vec3 &normal)
+    {
+        positions.push_back(pos);
+        us.push_back(u);
+        vs.push_back(v);
+        normals.push_back(normal);
+        return uint32_t(positions.size() - 1);
+    }
+
+    void add_triangle(uint32_t i0, uint32_t i1, uint32_t i2, uint16_t material_id)
+    {
+        indices.push_back(i0);
+        indices.push_back(i1);
+        indices.push_back(i2);
+        material_ids.push_back(material_id);
+    }
+
+    // Build the BVH and reorder the triangles into leaf order
+    void create_bvh_tree(int max_leaf_size = 5, BVHSplitMethod split_method = BVHSplitMethod::SAH, bool parallel = true)
+    {
+        std::vector<BVHPrimitiveInfo> info(triangle_count());
+#pragma omp parallel for if (parallel)
+        for (size_t i = 0; i < info.size(); i++)
+        {
+            info[i].index = i;
+            info[i].bounds = triangle_bounds(i);
+            info[i].centroid = info[i].bounds.centroid();
+        }
+
+        bvh = make_shared<BVH>(info, max_leaf_size, split_method, parallel);
+
+        std::vector<uint32_t> sorted_indices(indices.size());
+        std::vector<uint16_t> sorted_material_ids(material_ids.size());
+        for (size_t i = 0; i < info.size(); i++)
+        {
+            for (int k = 0; k < 3; k++)
+                sorted_indices[3 * i + k] = indices[3 * info[i].index + k];
+            sorted_material_ids[i] = material_ids[info[i].index];
+        }
+        indices.swap(sorted_indices);
+        material_ids.swap(sorted_material_ids);
+    }
+
+    // Refit the BVH after the vertices moved
+    void refit()
+    {
+        if (bvh)
+            bvh->refit([&](int i)
+                       { return triangle_bounds(i); });
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        if (!bvh)
+            return false;
+
+        return bvh->traverse(r, ray_t, rec, [&](const LinearBVHNode &leaf, interval &t_range, hit_record &leaf_rec)
+                             {
+                                 bool hit_anything = false;
+                                 int first = leaf.primitives_offset;
+                                 for (int i = first; i < first + leaf.n_primitives; i++)
+                                 {
+                                     real t, b1, b2;
+                                     const uint32_t *tri = &indices[3 * i];
+                                     if (intersect_triangle(r, positions[tri[0]], positions[tri[1]], positions[tri[2]],
+                                                            t_range, t, b1, b2))
+                                     {
+                                         hit_anything = true;
+                                         t_range.max = t;
+                                         leaf_rec.set_hit(t, this, i, b1, b2);
+                                     }
+                                 }
+                                 return hit_anything; });
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        if (!bvh)
+            return false;
+
+        hit_record unused;
+        return bvh->traverse<true>(r, ray_t, unused, [&](const LinearBVHNode &leaf, interval &t_range, hit_record &)
+                                   {
+                                       int first = leaf.primitives_offset;
+                                       for (int i = first; i < first + leaf.n_primitives; i++)
+                                       {
+                                           real t, b1, b2;
+                                           const uint32_t *tri = &indices[3 * i];
+                                           if (intersect_triangle(r, positions[tri[0]], positions[tri[1]], positions[tri[2]],
+                                                                  t_range, t, b1, b2))
+                                               return true;
+                                       }
+                                       return false; });
+    }
+
+    void resolve(const ray &r, hit_record &rec) const override
+    {
+        record_hit(r, rec.prim, rec.t, rec.b1, rec.b2, rec);
+    }
+
+    bbox get_bbox() const override
+    {
+        return bvh ? bvh->get_bbox() : bbox::empty;
+    }
+
+    bbox triangle_bounds(size_t i) const
+    {
+        const uint32_t *tri = &indices[3 * i];
+        return triangle_bbox(positions[tri[0]], positions[tri[1]], positions[tri[2]]);
+    }
+
+    // Bytes held by the vertex, index and material id arrays
+    size_t memory_bytes() const
+    {
+        return positions.size() * (2 * sizeof(vec3) + 2 * sizeof(real)) +
+               indices.size() * sizeof(uint32_t) + material_ids.size() * sizeof(uint16_t);
+    }
+
+private:
+    // Same attributes as triangle::record_hit, with the face normal computed on the fly
+    void record_hit(const ray &r, int i, real t, real b1, real b2, hit_record &rec) const
+    {
+        const uint32_t *tri = &indices[3 * i];
+        vec3 bary(1 - b1 - b2, b1, b2);
+        vec3 face = (positions[tri[1]] - positions[tri[0]]).cross(positions[tri[2]] - positions[tri[0]]).normalized();
+
+        rec.p = r.at(t);
+        rec.set_face_normal(r, face);
+        const vec3 &n0 = normals[tri[0]], &n1 = normals[tri[1]], &n2 = normals[tri[2]];
+        if (!n0.near_zero() && !n1.near_zero() && !n2.near_zero())
+        {
+            // Shading normal, kept on the same side of the surface as the face normal
+            vec3 n = interpolate(bary, n0, n1, n2).normalized();
+            if (n.dot(face) < 0)
+                n = -n;
+            rec.normal = rec.front_face ? n : -n;
+        }
+        rec.mat = materials[material_ids[i]].get();
+        rec.u = interpolate(bary, us[tri[0]], us[tri[1]], us[tri[2]]);
+        rec.v = interpolate(bary, vs[tri[0]], vs[tri[1]], vs[tri[2]]);
+    }
+};
+
+#endif
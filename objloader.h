@@ -5,7 +5,10 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <map>
+#include <tuple>
 #include "triangle.h"
+#include "mesh.h"
 #include "material.h"
 #include <Eigen/Eigen>
 
@@ -20,6 +23,7 @@ public:
     std::map<std::string, shared_ptr<material>> materials; // Material/texture map
 
     std::vector<shared_ptr<triangle>> triangles; // Triangle list
+    shared_ptr<mesh> indexed_mesh;               // Filled instead of triangles by indexed reads
     ObjLoader() {}
 
     inline bool read_obj(const std::string &filename, const std::string &texturename)
@@ -121,7 +125,8 @@ public:
         return true;
     }
 
-    bool read_obj_with_mtl(const std::string &objname, const std::string &mtlname)
+    // With `indexed`, faces go into indexed_mesh with shared vertices instead of triangles
+    bool read_obj_with_mtl(const std::string &objname, const std::string &mtlname, bool indexed = false)
     {
         // Pre-processing and file validation
         std::string objpath = "../" + objname;
@@ -208,6 +213,12 @@ public:
         materials["default"] = make_shared<lambertian>(vec3(0.5, 0.5, 0.5)); // Default material
 
         std::string current_mat = "default"; // Current material
+        if (indexed)
+        {
+            indexed_mesh = make_shared<mesh>();
+            mesh_vertices.clear();
+            mesh_materials.clear();
+        }
         while (std::getline(file, line))
         {
             std::istringstream iss(line);
@@ -252,6 +263,24 @@ public:
                     vn_idx[i] = result[2];
                 }
 
+                if (indexed)
+                {
+                    uint16_t mat_id = mesh_material_id(current_mat);
+                    uint32_t idx[3];
+                    for (int i = 0; i < 3; i++)
+                        idx[i] = mesh_vertex(v_idx[i], vt_idx[i], vn_idx[i]);
+                    indexed_mesh->add_triangle(idx[0], idx[1], idx[2], mat_id);
+
+                    // Handle quad faces (convert to two triangles)
+                    std::string vert3;
+                    if (iss >> vert3)
+                    {
+                        auto result = parse(vert3);
+                        indexed_mesh->add_triangle(idx[2], mesh_vertex(result[0], result[1], result[2]), idx[0], mat_id);
+                    }
+                    continue;
+                }
+
                 // Create triangle with current material
                 auto p0 = vertex(v_list[v_idx[0]], vt_u_list[vt_idx[0]], vt_v_list[vt_idx[0]], vn_list[vn_idx[0]]);
                 auto p1 = vertex(v_list[v_idx[1]], vt_u_list[vt_idx[1]], vt_v_list[vt_idx[1]], vn_list[vn_idx[1]]);
@@ -329,6 +358,9 @@ public:
 
     inline void apply_transformation()
     {
+        // Normals transform with the inverse transpose of the linear part
+        Eigen::Matrix3f normal_matrix = transformation.block<3, 3>(0, 0).inverse().transpose();
+
         // Apply transformation to all triangles
         for (auto &tri : triangles)
         {
@@ -344,6 +376,14 @@ public:
 
                 // Update vertex position
                 pos = vec3(a[0], a[1], a[2]);
+
+                // Update vertex normal
+                vec3 &normal = tri->vertices[i].normal;
+                if (!normal.near_zero())
+                {
+                    Eigen::Vector3f n = normal_matrix * Eigen::Vector3f(normal.x(), normal.y(), normal.z());
+                    normal = vec3(n[0], n[1], n[2]).normalized();
+                }
             }
 
             // Recalculate triangle normal and bounding box
@@ -351,13 +391,71 @@ public:
             tri->calculateNormal();
         }
 
+        // Shared vertices of the indexed mesh are transformed once
+        if (indexed_mesh)
+        {
+            for (size_t i = 0; i < indexed_mesh->positions.size(); i++)
+            {
+                vec3 &pos = indexed_mesh->positions[i];
+                Eigen::Vector4f a = transformation * Eigen::Vector4f(pos.x(), pos.y(), pos.z(), 1.0);
+                pos = vec3(a[0], a[1], a[2]);
+
+                vec3 &normal = indexed_mesh->normals[i];
+                if (!normal.near_zero())
+                {
+                    Eigen::Vector3f n = normal_matrix * Eigen::Vector3f(normal.x(), normal.y(), normal.z());
+                    normal = vec3(n[0], n[1], n[2]).normalized();
+                }
+            }
+        }
+
         // Reset transformation matrix to identity
         transformation = Eigen::Matrix4f::Identity();
     }
 
+    // Composed transformation, for instances that keep the mesh untouched
+    const Eigen::Matrix4f &get_transformation() const
+    {
+        return transformation;
+    }
+
+    inline void reset_transformation()
+    {
+        transformation = Eigen::Matrix4f::Identity();
+    }
+
 private:
     Eigen::Matrix4f transformation = Eigen::Matrix4f::Identity();
 
+    // Indexed reads: vertex of each (v, vt, vn) combination and id of each material
+    std::map<std::tuple<int, int, int>, uint32_t> mesh_vertices;
+    std::map<std::string, uint16_t> mesh_materials;
+
+    uint32_t mesh_vertex(int v_idx, int vt_idx, int vn_idx)
+    {
+        auto key = std::make_tuple(v_idx, vt_idx, vn_idx);
+        auto it = mesh_vertices.find(key);
+        if (it != mesh_vertices.end())
+            return it->second;
+
+        uint32_t index = indexed_mesh->add_vertex(v_list[v_idx], vt_u_list[vt_idx], vt_v_list[vt_idx], vn_list[vn_idx]);
+        mesh_vertices[key] = index;
+        return index;
+    }
+
+    uint16_t mesh_material_id(const std::string &name)
+    {
+        const std::string &found = materials.find(name) != materials.end() ? name : "default";
+        auto it = mesh_materials.find(found);
+        if (it != mesh_materials.end())
+            return it->second;
+
+        uint16_t id = uint16_t(indexed_mesh->materials.size());
+        indexed_mesh->materials.push_back(materials[found]);
+        mesh_materials[found] = id;
+        return id;
+    }
+
     // Parse vertex indices from face definition (v/vt/vn format)
     std::vector<int> parse(const std::string &s)
     {
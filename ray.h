@@ -1,17 +1,32 @@
 #ifndef RAY_H
 #define RAY_H
 
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
 class ray
 {
 public:
     ray() {}
 
-    ray(const vec3 &origin, const vec3 &direction) : orig(origin), dir(direction) {}
+    ray(const vec3 &origin, const vec3 &direction) : orig(origin), dir(direction)
+    {
+        // Cached once per ray, reused by every slab test during traversal
+        inv_dir = vec3(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+        dir_is_neg[0] = inv_dir.x() < 0;
+        dir_is_neg[1] = inv_dir.y() < 0;
+        dir_is_neg[2] = inv_dir.z() < 0;
+    }
 
     const vec3 &origin() const { return orig; }
     const vec3 &direction() const { return dir; }
+    const vec3 &inv_direction() const { return inv_dir; }
 
-    vec3 at(double t) const
+    // 1 if the direction is negative along the axis, 0 otherwise
+    int sign(int axis) const { return dir_is_neg[axis]; }
+
+    vec3 at(real t) const
     {
         return orig + t * dir;
     }
@@ -26,6 +41,8 @@ public:
 private:
     vec3 orig;
     vec3 dir;
+    vec3 inv_dir;
+    int dir_is_neg[3];
 };
 
 std::ostream &operator<<(std::ostream &os, ray v)
@@ -34,4 +51,38 @@ std::ostream &operator<<(std::ostream &os, ray v)
     return os;
 }
 
+// Origin for a ray leaving a surface at `p` in direction `dir`
+// The point is pushed off the surface along the normal, to the side the ray
+// leaves to, by a fixed number of ulps of its coordinates (a fixed distance
+// near zero, where ulps get tiny). This follows the rounding error of the hit
+// point at any scale, so secondary rays can start at t = 0 instead of
+// skipping a fixed epsilon (Wächter and Binder, Ray Tracing Gems, ch. 6).
+inline vec3 offset_ray_origin(const vec3 &p, const vec3 &n, const vec3 &dir)
+{
+    using bits = std::conditional_t<sizeof(real) == 4, int32_t, int64_t>;
+    constexpr real origin = real(1.0 / 32);
+    constexpr real int_scale = 256;
+    // 2^-16 for floats, scaled down by the 29 extra mantissa bits of doubles
+    constexpr real float_scale = sizeof(real) == 4 ? real(1.0 / 65536) : real(1.0 / 65536 / (1 << 29));
+
+    vec3 offset = dir.dot(n) < 0 ? -n : n;
+    vec3 result;
+    for (int i = 0; i < 3; i++)
+    {
+        if (std::fabs(p[i]) < origin)
+        {
+            result[i] = p[i] + float_scale * offset[i];
+            continue;
+        }
+        bits ulps = bits(int_scale * offset[i]);
+        real coord = p[i];
+        bits as_bits;
+        std::memcpy(&as_bits, &coord, sizeof(coord));
+        as_bits += coord < 0 ? -ulps : ulps;
+        std::memcpy(&coord, &as_bits, sizeof(coord));
+        result[i] = coord;
+    }
+    return result;
+}
+
 #endif
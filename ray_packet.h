@@ -0,0 +1,46 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "simd.h"
+
+// Four rays traced together through the BVH, stored as SoA lanes
+// Primary rays of neighbouring pixels are coherent, so one node fetch and one
+// vector box test serve all lanes. Active lanes are passed around as bit masks.
+class ray_packet
+{
+public:
+    static constexpr int WIDTH = 4;
+    static constexpr int ALL = (1 << WIDTH) - 1;
+
+    ray rays[WIDTH];      // Scalar copies for per-lane fallbacks
+    double4 ox, oy, oz;   // Origins
+    double4 dx, dy, dz;   // Directions
+    double4 ix, iy, iz;   // Inverse directions
+    double4 t_min, t_max; // t_max shrinks to the closest hit of each lane
+
+    ray_packet(const ray (&r)[WIDTH], interval ray_t)
+    {
+        for (int k = 0; k < WIDTH; k++)
+        {
+            rays[k] = r[k];
+            ox[k] = r[k].origin().x();
+            oy[k] = r[k].origin().y();
+            oz[k] = r[k].origin().z();
+            dx[k] = r[k].direction().x();
+            dy[k] = r[k].direction().y();
+            dz[k] = r[k].direction().z();
+            ix[k] = r[k].inv_direction().x();
+            iy[k] = r[k].inv_direction().y();
+            iz[k] = r[k].inv_direction().z();
+        }
+        t_min = splat4(ray_t.min);
+        t_max = splat4(ray_t.max);
+    }
+
+    interval lane_interval(int k) const
+    {
+        return interval(t_min[k], t_max[k]);
+    }
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+// PCG32 random number generator (M. O'Neill, https://www.pcg-random.org)
+// Every render thread owns its own sampler, so drawing a number never touches
+// shared state. Reseeding per (pixel, sample) makes each path independent of
+// which thread traces it, so images are reproducible at any thread count.
+class sampler
+{
+public:
+    sampler() { seed(0, 0); }
+    sampler(uint64_t seed_value, uint64_t stream = 0) { seed(seed_value, stream); }
+
+    void seed(uint64_t seed_value, uint64_t stream = 0)
+    {
+        state = 0u;
+        inc = (stream << 1u) | 1u;
+        next_uint();
+        state += seed_value;
+        next_uint();
+    }
+
+    // Deterministic sequence for one sample of one pixel
+    void start_pixel_sample(uint64_t pixel, uint64_t sample, uint64_t frame_seed = 0)
+    {
+        seed(mix(frame_seed ^ mix(sample)), pixel);
+    }
+
+    // Sequence for a look-ahead ray of a pixel (e.g. the sample-rate probe),
+    // on a sample index no real sample reaches
+    void start_pixel_probe(uint64_t pixel, uint64_t frame_seed = 0)
+    {
+        start_pixel_sample(pixel, PROBE_SAMPLE, frame_seed);
+    }
+
+    uint32_t next_uint()
+    {
+        uint64_t old_state = state;
+        state = old_state * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = uint32_t(((old_state >> 18u) ^ old_state) >> 27u);
+        uint32_t rot = uint32_t(old_state >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+
+    // Returns a random real number in [0,1)
+    double next_double()
+    {
+        return next_uint() * 0x1p-32;
+    }
+
+private:
+    static constexpr uint64_t PROBE_SAMPLE = ~0ULL;
+
+    uint64_t state;
+    uint64_t inc;
+
+    // SplitMix64 finalizer, spreads nearby seeds over the whole state space
+    static uint64_t mix(uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+};
+
+#endif
@@ -1,9 +1,15 @@
 #ifndef SCREEN_H
 #define SCREEN_H
 
-#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#ifndef HEADLESS
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#endif
 #include "interval.h"
 #include "vec3.h"
+#include "image_writer.h"
 
 class Screen
 {
@@ -55,8 +61,35 @@ public:
         image_buffer[index + 2] = rbyte;
     }
 
+    // Final pass from a linear float RGB image to rows [y_begin, y_end)
+    // Scaled by `exposure`, optionally compressed by Reinhard's c / (1 + c),
+    // then gamma encoded and quantized like set_color, in double as well. The
+    // inner loop runs over the floats of a row without branches, so it vectorizes.
+    void tonemap(const float *rgb, int y_begin, int y_end, double exposure, bool reinhard, bool parallel)
+    {
+#pragma omp parallel for if (parallel)
+        for (int y = y_begin; y < y_end; y++)
+        {
+            const float *src = rgb + size_t(y) * width * 3;
+            unsigned char *dst = image_buffer + size_t(y) * width * 3;
+#pragma omp simd
+            for (int k = 0; k < width * 3; k++)
+            {
+                double c = src[k] * exposure;
+                c = c > 0 ? c : 0.0; // Also NaN to black, like linear_to_gamma
+                c = reinhard ? c / (1 + c) : c;
+                dst[k] = (unsigned char)(int)(256 * std::min(std::sqrt(c), 0.999));
+            }
+            // RGB to BGR
+            for (int x = 0; x < width; x++)
+                std::swap(dst[3 * x], dst[3 * x + 2]);
+        }
+    }
+
+    // Show the image in a window, nothing in headless builds
     void display(int delay = 1)
     {
+#ifndef HEADLESS
         // 1. Create OpenCV image from buffer
         cv::Mat image(height, width, CV_8UC3, image_buffer);
 
@@ -67,13 +100,47 @@ public:
         // 3. Display the scaled image
         cv::imshow(name, scaled_image);
         cv::waitKey(delay);
+#endif
     }
 
-    void save(const std::string &filepath)
+    // Write the image, .png and .ppm without OpenCV and any other format
+    // (.jpg, .bmp, .tiff, ...) with cv::imwrite, which headless builds still link
+    bool save(const std::string &filepath) const
     {
-        // Create OpenCV image and save to file
+        if (is_builtin_image_format(filepath))
+            return write_image(filepath, image_buffer, width, height);
+
         cv::Mat image(height, width, CV_8UC3, image_buffer);
-        cv::imwrite(filepath, image);
+        if (!cv::imwrite(filepath, image))
+        {
+            std::cerr << "Error: Cannot write \"" << filepath << "\"." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Per-channel difference to an image on disk, in 0-255 units
+    // Returns false when the image cannot be read or its size differs
+    bool compare(const std::string &filepath, double &mean_diff, int &max_diff) const
+    {
+        cv::Mat reference = cv::imread(filepath, cv::IMREAD_COLOR);
+        if (reference.empty() || reference.rows != height || reference.cols != width)
+            return false;
+
+        long long sum = 0;
+        max_diff = 0;
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char *row = reference.ptr<unsigned char>(y);
+            for (int x = 0; x < width * 3; x++)
+            {
+                int diff = std::abs(int(row[x]) - int(image_buffer[y * width * 3 + x]));
+                sum += diff;
+                max_diff = std::max(max_diff, diff);
+            }
+        }
+        mean_diff = double(sum) / (double(width) * height * 3);
+        return true;
     }
 };
 
@@ -0,0 +1,54 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstdint>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+// 4-wide double vectors (GCC/Clang vector extensions)
+// With -march=native these compile to one AVX instruction per operation,
+// to SSE2 pairs or NEON on other targets, without separate code paths.
+typedef double double4 __attribute__((vector_size(32)));
+typedef int64_t mask4 __attribute__((vector_size(32))); // Lane is all ones when true
+typedef float float4 __attribute__((vector_size(16)));  // Compact storage, widened to double4 for math
+
+inline double4 splat4(double s)
+{
+    return double4{s, s, s, s};
+}
+
+inline double4 widen4(float4 a)
+{
+    return __builtin_convertvector(a, double4);
+}
+
+// Same operand order as std::min/std::max: a lane where either side is NaN
+// returns a. Slab tests pass the running t_min/t_max as a, so a NaN from
+// 0 * inf is dropped exactly as in the scalar bbox::hit.
+inline double4 min4(double4 a, double4 b)
+{
+    return b < a ? b : a;
+}
+
+inline double4 max4(double4 a, double4 b)
+{
+    return a < b ? b : a;
+}
+
+inline double4 abs4(double4 a)
+{
+    return a < 0 ? -a : a;
+}
+
+// One bit per lane, lane 0 in bit 0
+inline int movemask4(mask4 m)
+{
+#ifdef __AVX__
+    return _mm256_movemask_pd(__m256d(m));
+#else
+    return int(m[0] & 1) | int(m[1] & 1) << 1 | int(m[2] & 1) << 2 | int(m[3] & 1) << 3;
+#endif
+}
+
+#endif
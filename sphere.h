@@ -3,12 +3,39 @@
 
 #include "hittable.h"
 
+// Nearest root of the ray/sphere equation that lies in ray_t
+inline bool intersect_sphere(const ray &r, const vec3 &center, real radius, interval ray_t, real &t)
+{
+    vec3 oc = center - r.origin();
+    auto a = r.direction().length_squared();
+    auto h = r.direction().dot(oc);
+    auto c = oc.length_squared() - radius * radius;
+
+    auto discriminant = h * h - a * c;
+    if (discriminant < 0)
+        return false;
+
+    auto sqrtd = std::sqrt(discriminant);
+
+    // Find the nearest root that lies in the acceptable range.
+    auto root = (h - sqrtd) / a;
+    if (!ray_t.surrounds(root))
+    {
+        root = (h + sqrtd) / a;
+        if (!ray_t.surrounds(root))
+            return false;
+    }
+
+    t = root;
+    return true;
+}
+
 class sphere : public hittable
 {
 public:
     shared_ptr<material> mat;
 
-    sphere(const vec3 &center, double radius, shared_ptr<material> mat)
+    sphere(const vec3 &center, real radius, shared_ptr<material> mat)
         : center(center), radius(std::fmax(0, radius)), mat(mat)
     {
         b = bbox(
@@ -19,27 +46,22 @@ public:
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
-        vec3 oc = center - r.origin();
-        auto a = r.direction().length_squared();
-        auto h = r.direction().dot(oc);
-        auto c = oc.length_squared() - radius * radius;
-
-        auto discriminant = h * h - a * c;
-        if (discriminant < 0)
+        real t;
+        if (!intersect_sphere(r, center, radius, ray_t, t))
             return false;
 
-        auto sqrtd = std::sqrt(discriminant);
+        rec.set_hit(t, this);
+        return true;
+    }
 
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (h - sqrtd) / a;
-        if (!ray_t.surrounds(root))
-        {
-            root = (h + sqrtd) / a;
-            if (!ray_t.surrounds(root))
-                return false;
-        }
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        real t;
+        return intersect_sphere(r, center, radius, ray_t, t);
+    }
 
-        rec.t = root;
+    void resolve(const ray &r, hit_record &rec) const override
+    {
         rec.p = r.at(rec.t);
         vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
@@ -48,9 +70,7 @@ public:
         rec.u = 0;
         rec.v = 0;
 
-        rec.mat = mat;
-
-        return true;
+        rec.mat = mat.get();
     }
 
     bbox get_bbox() const override
@@ -58,10 +78,47 @@ public:
         return b;
     }
 
+    // Direction from `origin` to a uniform sample of the cone the sphere subtends
+    vec3 sample_direction(const vec3 &origin, sampler &rng) const
+    {
+        vec3 d = center - origin;
+        double dist_squared = d.length_squared();
+        double cos_max = 1 - cone_height(dist_squared);
+        double z = 1 + random_double(rng) * (cos_max - 1);
+        double phi = 2 * pi * random_double(rng);
+        double r = std::sqrt(std::max(0.0, 1 - z * z));
+
+        // Orthonormal basis around the direction to the center
+        vec3 w = d / std::sqrt(dist_squared);
+        vec3 a = std::fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        vec3 v = w.cross(a).normalized();
+        vec3 u = w.cross(v);
+        return r * std::cos(phi) * u + r * std::sin(phi) * v + z * w;
+    }
+
+    // Solid angle pdf of sample_direction, 0 from inside the sphere
+    double pdf_direction(const vec3 &origin) const
+    {
+        double dist_squared = (center - origin).length_squared();
+        if (dist_squared <= radius * radius)
+            return 0;
+        return 1 / (2 * pi * cone_height(dist_squared));
+    }
+
+    const vec3 &get_center() const { return center; }
+    real get_radius() const { return radius; }
+
 private:
     vec3 center;
-    double radius;
+    real radius;
     bbox b;
+
+    // 1 - cos of the cone half angle, written so small far spheres keep their precision
+    double cone_height(double dist_squared) const
+    {
+        double x = std::min(1.0, double(radius) * radius / dist_squared);
+        return x / (1 + std::sqrt(1 - x));
+    }
 };
 
 #endif
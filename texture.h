@@ -2,7 +2,8 @@
 #define TEXTURE_H
 
 #include "vec3.h"
-#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
 
 class texture
 {
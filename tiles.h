@@ -0,0 +1,199 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <omp.h>
+#include <vector>
+
+// Rectangle of pixels [x0, x1) x [y0, y1) rendered as one work item
+struct Tile
+{
+    int x0, y0, x1, y1;
+
+    int pixel_count() const { return (x1 - x0) * (y1 - y0); }
+};
+
+// Time spent on each tile, summed over all runs of the scheduler
+struct TileStats
+{
+    std::vector<double> ms; // Indexed like TileScheduler::tiles
+    long long steals = 0;   // Tile ranges taken from another thread's queue
+
+    double total_ms() const
+    {
+        double total = 0;
+        for (double t : ms)
+            total += t;
+        return total;
+    }
+
+    double max_ms() const
+    {
+        return ms.empty() ? 0 : *std::max_element(ms.begin(), ms.end());
+    }
+
+    double mean_ms() const
+    {
+        return ms.empty() ? 0 : total_ms() / ms.size();
+    }
+};
+
+// Splits the image into square tiles along a Hilbert curve and hands them to
+// the threads through work-stealing queues
+// Neighbouring tiles in the order are neighbours on screen, so a thread
+// walking its own part of the curve keeps touching the same BVH nodes. Each
+// thread starts on one contiguous part, and an idle thread takes the second
+// half of what is left in another thread's queue, from its far end.
+class TileScheduler
+{
+public:
+    std::vector<Tile> tiles; // Hilbert order
+    TileStats stats;
+
+    TileScheduler() {}
+    TileScheduler(int width, int y_begin, int y_end, int tile_size)
+    {
+        tile_size = std::max(1, tile_size);
+        int columns = (width + tile_size - 1) / tile_size;
+        int rows = (std::max(0, y_end - y_begin) + tile_size - 1) / tile_size;
+
+        int n = 1;
+        while (n < columns || n < rows)
+            n *= 2;
+        for (int d = 0; d < n * n; d++)
+        {
+            int tx, ty;
+            hilbert_d2xy(n, d, tx, ty);
+            if (tx >= columns || ty >= rows)
+                continue;
+            int x0 = tx * tile_size, y0 = y_begin + ty * tile_size;
+            tiles.push_back({x0, y0, std::min(x0 + tile_size, width), std::min(y0 + tile_size, y_end)});
+        }
+        stats.ms.assign(tiles.size(), 0.0);
+        tile_locks.reset(new std::mutex[tiles.size()]);
+    }
+
+    // Calls read_tile(tile) for every tile no thread is rendering right now,
+    // skipping busy ones. A tile's pixels are only written while its lock is
+    // held, so another thread can read them here while run() is going on.
+    template <typename TileFunc>
+    void read_idle_tiles(TileFunc &&read_tile)
+    {
+        for (size_t index = 0; index < tiles.size(); index++)
+        {
+            std::unique_lock<std::mutex> guard(tile_locks[index], std::try_to_lock);
+            if (guard.owns_lock())
+                read_tile(tiles[index]);
+        }
+    }
+
+    // Calls render_tile(tile) once for every tile, from all OpenMP threads
+    template <typename TileFunc>
+    void run(TileFunc &&render_tile, bool use_openmp)
+    {
+        int n_queues = use_openmp ? omp_get_max_threads() : 1;
+        std::vector<TileQueue> queues(n_queues);
+        for (int q = 0; q < n_queues; q++)
+        {
+            queues[q].begin = int(size_t(tiles.size()) * q / n_queues);
+            queues[q].end = int(size_t(tiles.size()) * (q + 1) / n_queues);
+        }
+        std::atomic<long long> steals(0);
+
+#pragma omp parallel if (use_openmp)
+        {
+            // The team may be smaller than n_queues, queues without a thread are stolen from
+            int self = omp_get_thread_num() % n_queues;
+            int index;
+            while (next_tile(queues, self, index, steals))
+            {
+                auto start = std::chrono::steady_clock::now();
+                {
+                    std::lock_guard<std::mutex> guard(tile_locks[index]);
+                    render_tile(tiles[index]);
+                }
+                auto end = std::chrono::steady_clock::now();
+                stats.ms[index] += std::chrono::duration<double, std::milli>(end - start).count();
+            }
+        }
+
+        stats.steals += steals;
+    }
+
+private:
+    std::unique_ptr<std::mutex[]> tile_locks; // Held while a tile is rendered, indexed like tiles
+
+    struct alignas(64) TileQueue
+    {
+        std::mutex lock;
+        int begin = 0, end = 0; // Tile indices still to render
+    };
+
+    // Pops the next tile of queue `self`, stealing when it is empty
+    static bool next_tile(std::vector<TileQueue> &queues, int self, int &index, std::atomic<long long> &steals)
+    {
+        TileQueue &own = queues[self];
+        {
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (own.begin < own.end)
+            {
+                index = own.begin++;
+                return true;
+            }
+        }
+
+        int n_queues = int(queues.size());
+        for (int k = 1; k < n_queues; k++)
+        {
+            TileQueue &victim = queues[(self + k) % n_queues];
+            int begin, end;
+            {
+                std::lock_guard<std::mutex> guard(victim.lock);
+                int left = victim.end - victim.begin;
+                if (left <= 0)
+                    continue;
+                end = victim.end;
+                begin = end - (left + 1) / 2;
+                victim.end = begin;
+            }
+            steals++;
+
+            // Keep the first stolen tile, the rest become the own queue
+            std::lock_guard<std::mutex> guard(own.lock);
+            index = begin;
+            own.begin = begin + 1;
+            own.end = end;
+            return true;
+        }
+        return false;
+    }
+
+    // Cell (x, y) at distance d along the Hilbert curve filling an n x n grid,
+    // n a power of two
+    static void hilbert_d2xy(int n, int d, int &x, int &y)
+    {
+        x = y = 0;
+        for (int s = 1, t = d; s < n; s *= 2, t /= 4)
+        {
+            int rx = 1 & (t / 2);
+            int ry = 1 & (t ^ rx);
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
+        }
+    }
+};
+
+#endif
@@ -20,11 +20,19 @@ public:
         start = std::chrono::high_resolution_clock::now();
     }
 
-    void stop_timer()
+    // Prints and returns the elapsed time in ms
+    long long stop_timer()
     {
         auto end = std::chrono::high_resolution_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
         std::cout << message << duration.count() << " ms\n";
+        return duration.count();
+    }
+
+    // Prints a statistic next to the timings
+    void report(const std::string &msg, double value, const std::string &unit = "")
+    {
+        std::cout << "[Timer] " << msg << ": " << value << (unit.empty() ? "" : " ") << unit << "\n";
     }
 
 private:
@@ -9,13 +9,13 @@ class vertex
 {
 public:
     vec3 pos;    // Vertex position
-    double u;    // Texture coordinate u
-    double v;    // Texture coordinate v
+    real u;    // Texture coordinate u
+    real v;    // Texture coordinate v
     vec3 normal; // Vertex normal
 
     vertex() {}
     vertex(const vec3 &pos) : pos(pos), u(-1), v(-1), normal(vec3(0, 0, 0)) {}
-    vertex(const vec3 &pos, double u, double v, const vec3 &normal) : pos(pos), u(u), v(v), normal(normal) {}
+    vertex(const vec3 &pos, real u, real v, const vec3 &normal) : pos(pos), u(u), v(v), normal(normal) {}
 
     std::string toString() const
     {
@@ -35,6 +35,87 @@ std::ostream &operator<<(std::ostream &os, vertex v)
     return os;
 }
 
+// Möller–Trumbore: t and barycentrics (b1, b2) from one set of edge vectors
+// e1 = p1 - p0 and e2 = p2 - p0
+inline bool intersect_triangle_edges(const ray &r, const vec3 &p0, const vec3 &e1, const vec3 &e2,
+                                     interval ray_t, real &t, real &b1, real &b2)
+{
+    vec3 pvec = r.direction().cross(e2);
+    real det = e1.dot(pvec);
+
+    // Exclude parallel cases (ray parallel to triangle plane)
+    if (std::fabs(det) < real(1e-16))
+        return false;
+    real inv_det = 1.0 / det;
+
+    vec3 tvec = r.origin() - p0;
+    b1 = tvec.dot(pvec) * inv_det;
+    if (b1 < 0 || b1 > 1)
+        return false;
+
+    vec3 qvec = tvec.cross(e1);
+    b2 = r.direction().dot(qvec) * inv_det;
+    if (b2 < 0 || b1 + b2 > 1)
+        return false;
+
+    // Check if ray is already blocked
+    t = e2.dot(qvec) * inv_det;
+    return ray_t.contains(t);
+}
+
+inline bool intersect_triangle(const ray &r, const vec3 &p0, const vec3 &p1, const vec3 &p2,
+                               interval ray_t, real &t, real &b1, real &b2)
+{
+    return intersect_triangle_edges(r, p0, p1 - p0, p2 - p0, ray_t, t, b1, b2);
+}
+
+// Möller–Trumbore for four rays at once, returns the lanes of `active` that hit
+inline int intersect_triangle_edges(const ray_packet &p, int active, const vec3 &p0, const vec3 &e1, const vec3 &e2,
+                                    double4 &t, double4 &b1, double4 &b2)
+{
+    double4 e1x = splat4(e1.x()), e1y = splat4(e1.y()), e1z = splat4(e1.z());
+    double4 e2x = splat4(e2.x()), e2y = splat4(e2.y()), e2z = splat4(e2.z());
+
+    // pvec = d x e2
+    double4 px = p.dy * e2z - p.dz * e2y;
+    double4 py = p.dz * e2x - p.dx * e2z;
+    double4 pz = p.dx * e2y - p.dy * e2x;
+    double4 det = e1x * px + e1y * py + e1z * pz;
+    double4 inv_det = 1.0 / det;
+
+    // tvec = o - p0
+    double4 tx = p.ox - splat4(p0.x());
+    double4 ty = p.oy - splat4(p0.y());
+    double4 tz = p.oz - splat4(p0.z());
+    b1 = (tx * px + ty * py + tz * pz) * inv_det;
+
+    // qvec = tvec x e1
+    double4 qx = ty * e1z - tz * e1y;
+    double4 qy = tz * e1x - tx * e1z;
+    double4 qz = tx * e1y - ty * e1x;
+    b2 = (p.dx * qx + p.dy * qy + p.dz * qz) * inv_det;
+    t = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+
+    mask4 inside = (abs4(det) >= 1e-16) & (b1 >= 0) & (b1 <= 1) & (b2 >= 0) & (b1 + b2 <= 1) &
+                   (t >= p.t_min) & (t <= p.t_max);
+    return movemask4(inside) & active;
+}
+
+// Bounding box of a triangle, padded so flat triangles keep a volume
+// The pad is 1e-8, or a few ulps where that is below the precision of `real`
+inline bbox triangle_bbox(const vec3 &p0, const vec3 &p1, const vec3 &p2)
+{
+    auto axis = [](real a, real b, real c)
+    {
+        interval i(std::min({a, b, c}), std::max({a, b, c}));
+        real magnitude = std::max(std::fabs(i.min), std::fabs(i.max));
+        return i.pad(std::max(real(1e-8), 4 * std::numeric_limits<real>::epsilon() * magnitude));
+    };
+    return bbox(axis(p0.x(), p1.x(), p2.x()),
+                axis(p0.y(), p1.y(), p2.y()),
+                axis(p0.z(), p1.z(), p2.z()));
+}
+
 class triangle : public hittable
 {
 public:
@@ -42,6 +123,7 @@ public:
     vec3 normal;        // Face normal
     shared_ptr<material> mat; // Material
     bbox b;             // Bounding box
+    bool smooth;        // Interpolate vertex normals for shading
 
     triangle(
         const vertex &p0,
@@ -53,6 +135,7 @@ public:
                                     vertices({p0, p1, p2})
     {
         calculateBBox();
+        calculateSmooth();
     }
 
     triangle(
@@ -64,42 +147,45 @@ public:
     {
         calculateBBox();
         calculateNormal();
+        calculateSmooth();
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
-        vec3 p1 = vertices[0].pos;
-        vec3 p2 = vertices[1].pos;
-        vec3 p3 = vertices[2].pos;
-
-        vec3 v1 = p1 - p2;
-        vec3 v2 = p1 - p3;
-        double d = normal.dot(r.direction());
-
-        // Exclude parallel cases (ray parallel to triangle plane)
-        if (abs(d) < 1e-16)
+        real t, b1, b2;
+        if (!intersect_triangle(r, vertices[0].pos, vertices[1].pos, vertices[2].pos, ray_t, t, b1, b2))
             return false;
 
-        double t = normal.dot(p1 - r.origin()) / d;
+        rec.set_hit(t, this, 0, b1, b2);
+        return true;
+    }
 
-        // Check if ray is already blocked
-        if (!ray_t.contains(t))
-            return false;
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        real t, b1, b2;
+        return intersect_triangle(r, vertices[0].pos, vertices[1].pos, vertices[2].pos, ray_t, t, b1, b2);
+    }
 
-        // Get intersection point with plane and check if inside triangle
-        vec3 p = r.at(t);
-        if (!insideTriangle(p))
-            return false;
+    // Möller–Trumbore for four rays against this triangle at once
+    int hit(ray_packet &p, int active, hit_record *recs) const override
+    {
+        const vec3 &p0 = vertices[0].pos;
+        double4 t, b1, b2;
+        int hits = intersect_triangle_edges(p, active, p0, vertices[1].pos - p0, vertices[2].pos - p0, t, b1, b2);
 
-        // Record intersection details
-        rec.t = t;
-        rec.p = p;
-        rec.set_face_normal(r, normal);
-        rec.mat = mat;
-        rec.u = interpolate(computeBarycentric(p), vertices[0].u, vertices[1].u, vertices[2].u);
-        rec.v = interpolate(computeBarycentric(p), vertices[0].v, vertices[1].v, vertices[2].v);
+        for (int k = 0; k < ray_packet::WIDTH; k++)
+        {
+            if (!(hits >> k & 1))
+                continue;
+            recs[k].set_hit(t[k], this, 0, b1[k], b2[k]);
+            p.t_max[k] = t[k];
+        }
+        return hits;
+    }
 
-        return true;
+    void resolve(const ray &r, hit_record &rec) const override
+    {
+        record_hit(r, rec.t, rec.b1, rec.b2, rec);
     }
 
     bbox get_bbox() const override
@@ -123,18 +209,7 @@ public:
     // Calculate bounding box
     void calculateBBox()
     {
-        const vertex &p0 = vertices[0];
-        const vertex &p1 = vertices[1];
-        const vertex &p2 = vertices[2];
-
-        double xs[3] = {p0.pos.x(), p1.pos.x(), p2.pos.x()};
-        double ys[3] = {p0.pos.y(), p1.pos.y(), p2.pos.y()};
-        double zs[3] = {p0.pos.z(), p1.pos.z(), p2.pos.z()};
-
-        b = bbox(
-            interval(std::min({xs[0], xs[1], xs[2]}), std::max({xs[0], xs[1], xs[2]})).pad(1e-8),
-            interval(std::min({ys[0], ys[1], ys[2]}), std::max({ys[0], ys[1], ys[2]})).pad(1e-8),
-            interval(std::min({zs[0], zs[1], zs[2]}), std::max({zs[0], zs[1], zs[2]})).pad(1e-8));
+        b = triangle_bbox(vertices[0].pos, vertices[1].pos, vertices[2].pos);
     }
 
     // Calculate face normal
@@ -147,57 +222,33 @@ public:
         normal = (p1.pos - p0.pos).cross(p2.pos - p0.pos).normalized();
     }
 
-private:
-    vec3 computeBarycentric(const vec3 &p) const
+    // Record intersection details, reusing the barycentrics for all attributes
+    void record_hit(const ray &r, real t, real b1, real b2, hit_record &rec) const
     {
-        vec3 p1 = vertices[0].pos;
-        vec3 p2 = vertices[1].pos;
-        vec3 p3 = vertices[2].pos;
-
-        // Compute vectors
-        vec3 v0 = p2 - p1;
-        vec3 v1 = p3 - p1;
-        vec3 v2 = p - p1;
-
-        // Compute cross product areas
-        float d00 = v0.dot(v0);
-        float d01 = v0.dot(v1);
-        float d11 = v1.dot(v1);
-        float d20 = v2.dot(v0);
-        float d21 = v2.dot(v1);
-
-        float denom = d00 * d11 - d01 * d01;
-
-        // Prevent division by zero
-        if (denom == 0.0)
-            return vec3(-1, -1, -1); // Return special value for invalid case
-
-        float v = (d11 * d20 - d01 * d21) / denom;
-        float w = (d00 * d21 - d01 * d20) / denom;
-        float u = 1 - v - w;
-
-        return vec3(u, v, w);
+        vec3 bary(1 - b1 - b2, b1, b2);
+        rec.p = r.at(t);
+        rec.set_face_normal(r, normal);
+        if (smooth)
+        {
+            // Shading normal, kept on the same side of the surface as the face normal
+            vec3 n = interpolate(bary, vertices[0].normal, vertices[1].normal, vertices[2].normal).normalized();
+            if (n.dot(normal) < 0)
+                n = -n;
+            rec.normal = rec.front_face ? n : -n;
+        }
+        rec.mat = mat.get();
+        rec.u = interpolate(bary, vertices[0].u, vertices[1].u, vertices[2].u);
+        rec.v = interpolate(bary, vertices[0].v, vertices[1].v, vertices[2].v);
     }
 
-    bool insideTriangle(const vec3 &p) const
+    // Use vertex normals only when all three are present
+    void calculateSmooth()
     {
-        // Compute cross products between point p and triangle edges
-        vec3 p1 = vertices[0].pos;
-        vec3 p2 = vertices[1].pos;
-        vec3 p3 = vertices[2].pos;
-
-        vec3 c1 = (p - p1).cross(p2 - p1);
-        vec3 c2 = (p - p2).cross(p3 - p2);
-        vec3 c3 = (p - p3).cross(p1 - p3);
-
-        // Check sign consistency (dot product with normal)
-        double dot1 = c1.dot(normal);
-        double dot2 = c2.dot(normal);
-        double dot3 = c3.dot(normal);
-
-        // If all dot products have same sign (including zero for edge cases)
-        return (dot1 >= 0 && dot2 >= 0 && dot3 >= 0) || (dot1 <= 0 && dot2 <= 0 && dot3 <= 0);
+        smooth = !vertices[0].normal.near_zero() &&
+                 !vertices[1].normal.near_zero() &&
+                 !vertices[2].normal.near_zero();
     }
+
 };
 
 std::ostream &operator<<(std::ostream &os, triangle v)
@@ -4,18 +4,18 @@
 class vec3
 {
 public:
-    double e[3];  // Vector components (x,y,z)
+    real e[3];  // Vector components (x,y,z)
 
     vec3() : e{0, 0, 0} {}
-    vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    vec3(real e0, real e1, real e2) : e{e0, e1, e2} {}
 
-    double x() const { return e[0]; }  // Get x component
-    double y() const { return e[1]; }  // Get y component
-    double z() const { return e[2]; }  // Get z component
+    real x() const { return e[0]; }  // Get x component
+    real y() const { return e[1]; }  // Get y component
+    real z() const { return e[2]; }  // Get z component
 
     vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }  // Unary minus
-    double operator[](int i) const { return e[i]; }  // Const component access
-    double &operator[](int i) { return e[i]; }  // Non-const component access
+    real operator[](int i) const { return e[i]; }  // Const component access
+    real &operator[](int i) { return e[i]; }  // Non-const component access
 
     vec3 &operator+=(const vec3 &v)
     {
@@ -25,7 +25,7 @@ public:
         return *this;
     }
 
-    vec3 &operator*=(double t)
+    vec3 &operator*=(real t)
     {
         e[0] *= t;
         e[1] *= t;
@@ -33,17 +33,17 @@ public:
         return *this;
     }
 
-    vec3 &operator/=(double t)
+    vec3 &operator/=(real t)
     {
         return *this *= 1 / t;
     }
 
-    double length() const
+    real length() const
     {
         return std::sqrt(length_squared());
     }
 
-    double length_squared() const
+    real length_squared() const
     {
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
     }
@@ -55,17 +55,17 @@ public:
         return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
     }
 
-    static vec3 random()
+    static vec3 random(sampler &rng)
     {
-        return vec3(random_double(), random_double(), random_double());
+        return vec3(random_double(rng), random_double(rng), random_double(rng));
     }
 
-    static vec3 random(double min, double max)
+    static vec3 random(sampler &rng, real min, real max)
     {
-        return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+        return vec3(random_double(rng, min, max), random_double(rng, min, max), random_double(rng, min, max));
     }
 
-    double dot(const vec3 &v) const
+    real dot(const vec3 &v) const
     {
         return e[0] * v.e[0] + e[1] * v.e[1] + e[2] * v.e[2];
     }
@@ -79,7 +79,7 @@ public:
 
     vec3 normalized() const
     {
-        double len = length();
+        real len = length();
         return vec3(e[0] / len, e[1] / len, e[2] / len);
     }
 
@@ -116,31 +116,31 @@ inline vec3 operator*(const vec3 &u, const vec3 &v)
 }
 
 // Scalar multiplication
-inline vec3 operator*(double t, const vec3 &v)
+inline vec3 operator*(real t, const vec3 &v)
 {
     return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &v, double t)
+inline vec3 operator*(const vec3 &v, real t)
 {
     return t * v;
 }
 
-inline vec3 operator/(const vec3 &v, double t)
+inline vec3 operator/(const vec3 &v, real t)
 {
     return (1 / t) * v;
 }
 
-inline vec3 random_unit_vector()
+inline vec3 random_unit_vector(sampler &rng)
 {
     // Analytical transformation (no loop, more efficient)
-    double theta = 2 * M_PI * random_double();  // Azimuth angle [0, 2π)
-    double phi = acos(1 - 2 * random_double()); // Polar angle [0, π]
+    real theta = 2 * M_PI * random_double(rng);  // Azimuth angle [0, 2π)
+    real phi = acos(1 - 2 * random_double(rng)); // Polar angle [0, π]
 
-    double sin_phi = sin(phi);
-    double x = sin_phi * cos(theta);
-    double y = sin_phi * sin(theta);
-    double z = cos(phi);
+    real sin_phi = sin(phi);
+    real x = sin_phi * cos(theta);
+    real y = sin_phi * sin(theta);
+    real z = cos(phi);
 
     return vec3(x, y, z);
 }
@@ -150,7 +150,7 @@ inline vec3 reflect(const vec3 &v, const vec3 &n)
     return v - 2 * v.dot(n) * n;
 }
 
-inline vec3 refract(const vec3 &uv, const vec3 &n, double etai_over_etat)
+inline vec3 refract(const vec3 &uv, const vec3 &n, real etai_over_etat)
 {
     auto cos_theta = std::fmin((-uv).dot(n), 1.0);
     vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
@@ -163,7 +163,7 @@ inline vec3 interpolate(const vec3 &weight, const vec3 &p1, const vec3 &p2, cons
     return p1 * weight.e[0] + p2 * weight.e[1] + p3 * weight.e[2];
 }
 
-inline double interpolate(const vec3 &weight, const double &v1, const double &v2, const double &v3)
+inline real interpolate(const vec3 &weight, const real &v1, const real &v2, const real &v3)
 {
     return v1 * weight.e[0] + v2 * weight.e[1] + v3 * weight.e[2];
 }
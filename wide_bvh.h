@@ -0,0 +1,290 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+// 4-wide BVH node with SoA child bounds
+// One ray is tested against all four child boxes with one sequence of
+// vector instructions. Unused slots hold an inverted box that never hits.
+struct alignas(64) WideBVHNode
+{
+    static constexpr int WIDTH = 4;
+
+    float4 bounds[2][3]; // [min/max][axis], one lane per child
+    int child[WIDTH];    // Interior child: node index, leaf child: first primitive, -1: empty
+    uint16_t count[WIDTH]; // Primitive count of leaf children, 0 for interior children
+
+    bool is_empty(int c) const { return child[c] < 0; }
+    bool is_leaf(int c) const { return count[c] > 0; }
+
+    // Returns one bit per child box hit, and the entry distance of each child
+    int hit(const double4 (&o)[3], const double4 (&inv)[3], const int (&sign)[3],
+            interval ray_t, double4 &t_near) const
+    {
+        double4 t_min = splat4(ray_t.min);
+        double4 t_max = splat4(ray_t.max);
+        for (int i = 0; i < 3; i++)
+        {
+            double4 t0 = (widen4(bounds[sign[i]][i]) - o[i]) * inv[i];
+            double4 t1 = (widen4(bounds[1 - sign[i]][i]) - o[i]) * inv[i];
+            t_min = max4(t_min, t0);
+            t_max = min4(t_max, t1);
+        }
+        t_near = t_min;
+        return movemask4(t_min < t_max);
+    }
+};
+
+// Collapsed version of a binary BVH (BVH4)
+// Each wide node pulls in the grandchildren of the binary tree, always opening
+// the largest interior child first, so the tree is about half as deep.
+class WideBVH : public hittable
+{
+public:
+    std::vector<WideBVHNode> nodes;
+    std::vector<int> leaf_node; // Binary leaf behind each child slot, for the BVH visualization
+    shared_ptr<BVH> binary;     // Owns the primitives and the debug info
+    BVHStats stats;
+
+    static constexpr int MAX_STACK_SIZE = 4 * BVH::MAX_STACK_DEPTH;
+
+    using hittable::hit; // Packets go through the per-lane fallback
+
+    WideBVH(shared_ptr<BVH> binary) : binary(binary)
+    {
+        if (binary->nodes.empty())
+            return;
+
+        nodes.reserve(binary->nodes.size() / 2 + 1);
+        leaf_node.reserve(2 * binary->nodes.size() + 4);
+        collapse(0);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        if (nodes.empty())
+            return false;
+
+        double4 o[3], inv[3];
+        int sign[3];
+        for (int i = 0; i < 3; i++)
+        {
+            o[i] = splat4(r.origin()[i]);
+            inv[i] = splat4(r.inv_direction()[i]);
+            sign[i] = r.sign(i);
+        }
+
+        struct StackEntry
+        {
+            int node; // Interior: wide node index, leaf: -(slot + 1)
+            double t_near;
+        };
+
+        bool hit_anything = false;
+        uint64_t steps = 0, prim_tests = 0;
+        StackEntry to_visit[MAX_STACK_SIZE];
+        int to_visit_offset = 0;
+        to_visit[to_visit_offset++] = {0, ray_t.min};
+
+        while (to_visit_offset > 0)
+        {
+            StackEntry entry = to_visit[--to_visit_offset];
+            if (entry.t_near > ray_t.max)
+                continue;
+
+            if (entry.node < 0)
+            {
+                // Leaf slot
+                int slot = -entry.node - 1;
+                const WideBVHNode &parent = nodes[slot / WideBVHNode::WIDTH];
+                int c = slot % WideBVHNode::WIDTH;
+                prim_tests += parent.count[c];
+                if (binary->hit_leaf(r, binary->nodes[leaf_node[slot]], ray_t, rec))
+                {
+                    hit_anything = true;
+                    if (!rec.bvh_info)
+                        rec.bvh_info = &binary->node_info[leaf_node[slot]];
+                }
+                continue;
+            }
+
+            steps++;
+            const WideBVHNode &node = nodes[entry.node];
+            double4 t_near;
+            int mask = node.hit(o, inv, sign, ray_t, t_near);
+            if (!mask)
+                continue;
+
+            // Push hit children far to near, so the nearest is popped first
+            int order[WideBVHNode::WIDTH];
+            int n = 0;
+            for (int c = 0; c < WideBVHNode::WIDTH; c++)
+            {
+                if (!(mask >> c & 1))
+                    continue;
+                int k = n++;
+                while (k > 0 && t_near[order[k - 1]] < t_near[c])
+                {
+                    order[k] = order[k - 1];
+                    k--;
+                }
+                order[k] = c;
+            }
+            for (int k = 0; k < n; k++)
+            {
+                int c = order[k];
+                int ref = node.is_leaf(c) ? -(entry.node * WideBVHNode::WIDTH + c + 1) : node.child[c];
+                to_visit[to_visit_offset++] = {ref, t_near[c]};
+            }
+        }
+
+        stats.add(1, steps, prim_tests);
+        return hit_anything;
+    }
+
+    // Any-hit query, the first primitive found in ray_t ends the traversal
+    bool occluded(const ray &r, interval ray_t) const override
+    {
+        if (nodes.empty())
+            return false;
+
+        double4 o[3], inv[3];
+        int sign[3];
+        for (int i = 0; i < 3; i++)
+        {
+            o[i] = splat4(r.origin()[i]);
+            inv[i] = splat4(r.inv_direction()[i]);
+            sign[i] = r.sign(i);
+        }
+
+        uint64_t steps = 0, prim_tests = 0;
+        int to_visit[MAX_STACK_SIZE]; // Interior: wide node index, leaf: -(slot + 1)
+        int to_visit_offset = 0;
+        to_visit[to_visit_offset++] = 0;
+        bool blocked = false;
+
+        while (to_visit_offset > 0 && !blocked)
+        {
+            int entry = to_visit[--to_visit_offset];
+            if (entry < 0)
+            {
+                int slot = -entry - 1;
+                prim_tests += nodes[slot / WideBVHNode::WIDTH].count[slot % WideBVHNode::WIDTH];
+                blocked = binary->occluded_leaf(r, binary->nodes[leaf_node[slot]], ray_t);
+                continue;
+            }
+
+            steps++;
+            const WideBVHNode &node = nodes[entry];
+            double4 t_near;
+            int mask = node.hit(o, inv, sign, ray_t, t_near);
+            // Nearest child on top, blockers are usually found near the origin
+            int order[WideBVHNode::WIDTH];
+            int n = 0;
+            for (int c = 0; c < WideBVHNode::WIDTH; c++)
+            {
+                if (!(mask >> c & 1))
+                    continue;
+                int k = n++;
+                while (k > 0 && t_near[order[k - 1]] < t_near[c])
+                {
+                    order[k] = order[k - 1];
+                    k--;
+                }
+                order[k] = c;
+            }
+            for (int k = 0; k < n; k++)
+            {
+                int c = order[k];
+                to_visit[to_visit_offset++] = node.is_leaf(c) ? -(entry * WideBVHNode::WIDTH + c + 1) : node.child[c];
+            }
+        }
+
+        stats.add(1, steps, prim_tests);
+        return blocked;
+    }
+
+    bbox get_bbox() const override
+    {
+        return binary->get_bbox();
+    }
+
+private:
+    // Build the wide node covering binary node `binary_index` (an interior node)
+    int collapse(int binary_index)
+    {
+        const auto &bnodes = binary->nodes;
+
+        // Open the largest interior child until four slots are used
+        std::vector<int> children;
+        if (bnodes[binary_index].is_leaf())
+            children.push_back(binary_index);
+        else
+        {
+            children.push_back(binary_index + 1);
+            children.push_back(bnodes[binary_index].second_child_offset);
+        }
+        while (int(children.size()) < WideBVHNode::WIDTH)
+        {
+            int best = -1;
+            double best_area = -1;
+            for (int k = 0; k < int(children.size()); k++)
+            {
+                const LinearBVHNode &c = bnodes[children[k]];
+                double area = c.box().surface_area();
+                if (!c.is_leaf() && area > best_area)
+                {
+                    best = k;
+                    best_area = area;
+                }
+            }
+            if (best < 0)
+                break;
+
+            int opened = children[best];
+            children[best] = opened + 1;
+            children.insert(children.begin() + best + 1, bnodes[opened].second_child_offset);
+        }
+
+        int node_index = int(nodes.size());
+        nodes.emplace_back();
+        leaf_node.resize(nodes.size() * WideBVHNode::WIDTH, -1);
+
+        for (int c = 0; c < WideBVHNode::WIDTH; c++)
+        {
+            WideBVHNode &node = nodes[node_index];
+            for (int i = 0; i < 3; i++)
+            {
+                node.bounds[0][i][c] = std::numeric_limits<float>::infinity();
+                node.bounds[1][i][c] = -std::numeric_limits<float>::infinity();
+            }
+            node.child[c] = -1;
+            node.count[c] = 0;
+        }
+
+        for (int c = 0; c < int(children.size()); c++)
+        {
+            const LinearBVHNode &b = bnodes[children[c]];
+            for (int i = 0; i < 3; i++)
+            {
+                nodes[node_index].bounds[0][i][c] = b.bounds[0][i];
+                nodes[node_index].bounds[1][i][c] = b.bounds[1][i];
+            }
+
+            if (b.is_leaf())
+            {
+                nodes[node_index].child[c] = b.primitives_offset;
+                nodes[node_index].count[c] = b.n_primitives;
+                leaf_node[node_index * WideBVHNode::WIDTH + c] = children[c];
+            }
+            else
+            {
+                // nodes may grow during recursion, write through the index afterwards
+                int child_index = collapse(children[c]);
+                nodes[node_index].child[c] = child_index;
+            }
+        }
+
+        return node_index;
+    }
+};
+
+#endif